@@ -20,9 +20,9 @@
  * to search for a specific pattern of text inside files and print the lines
  * that contain a match.
  *
- * Our goal is to build a simplified version of `grep`. It won't support complex
- * regular expressions, but it will search for a fixed string within a file and
- * print any matching lines. This is a fantastic project because it combines:
+ * Our goal is to build a simplified version of `grep`. It starts out searching
+ * for a fixed string within a file and printing any matching lines, and later
+ * learns regular expressions too. This is a fantastic project because it combines:
  *
  * 1. COMMAND-LINE ARGUMENTS: To get the search pattern and the filename from the user.
  * 2. FILE I/O: To open and read the target file.
@@ -31,39 +31,4333 @@
  *    file doesn't exist.
  *
  * THE PLAN:
- * 1. Get two arguments from the command line: the search `pattern` and the `filename`.
+ * 1. Get the search `pattern` and the `filename` (or several files and directories)
+ *    from the command line.
  * 2. Open the `filename` for reading.
- * 3. Read the file one line at a time.
- * 4. For each line, check if it contains the `pattern`.
- * 5. If it does, print that line to the console.
+ * 3. Read the file in large blocks.
+ * 4. Search each whole block for the `pattern`.
+ * 5. For every match, find the line around it and print that line to the console.
  * 6. Close the file and exit.
  *
+ * SEARCHING FASTER: PREPARING THE PATTERN ONCE
+ * The simplest search slides the pattern along the text one position at a time
+ * and compares it at every position. We search for the SAME pattern in every
+ * line, so it pays to study the pattern once up front and use what we learned
+ * to skip ahead. Our SEARCH ENGINE picks its method by pattern length:
+ * 1. ONE BYTE: `memchr()` from the C library. It is hand-tuned for every CPU and
+ *    checks many bytes per instruction.
+ * 2. LONG PATTERNS: BOYER-MOORE-HORSPOOL. Compare the LAST byte of the pattern
+ *    first. If that text byte does not appear in the pattern at all, the pattern
+ *    cannot overlap it, so we jump ahead by the whole pattern length. A SKIP TABLE
+ *    with one entry per possible byte value (256) says how far we may jump. The
+ *    longer the pattern, the longer the jumps: most text bytes are never looked at.
+ * 3. SHORT PATTERNS: the TWO-WAY algorithm (Crochemore and Perrin, 1991). It cuts
+ *    the pattern at a carefully chosen CRITICAL POSITION and compares the right
+ *    half first, then the left half. Using the pattern's PERIOD (the smallest
+ *    shift at which it matches itself, e.g. 2 for "abab"), it never compares a
+ *    text byte more than twice: the search time is always LINEAR in the text size.
+ * Horspool's worst case is not linear (try "aaaa...a" in a text of all 'a'), so
+ * the Horspool loop keeps an eye on how much comparing it does. If the text looks
+ * hostile, it hands the rest of the search over to Two-Way.
+ * That is how a C library searches inside, too, but the library tunes its code
+ * for every CPU, and on plain text its `memmem()` beats our portable loops at
+ * nearly every pattern length. So when the SIMD filter below is not available, a
+ * search that does not ignore case just calls `memmem()`. Two-Way and Horspool
+ * still do what `memmem()` cannot: `-i`, and the fallback for the SIMD filter.
+ * Run `./27_build_your_own_grep --bench` to compare them all with `memmem()`
+ * and `strstr()`.
+ *
+ * SEARCHING 32 POSITIONS AT ONCE: THE SIMD FILTER
+ * Modern x86 CPUs have AVX2 instructions that work on 32 bytes at a time. We pick
+ * the two RAREST bytes of the pattern (using a table of how common each byte is
+ * in typical text), say 'q' at offset 3 and 'z' at offset 7. Then, for 32 window
+ * positions at once, one vector compare checks "is there a 'q' 3 bytes in?" and
+ * another checks "is there a 'z' 7 bytes in?". Only positions that pass BOTH
+ * tests are CANDIDATES, and only those are checked in full with `memcmp()`. With
+ * rare bytes, most 32-byte blocks have no candidate at all, so the loop races
+ * through the text. The program asks the CPU at run time whether it has AVX2
+ * (`__builtin_cpu_supports`) and uses the other engines if it does not. Like
+ * Horspool, the filter watches for too many false candidates and falls back to
+ * Two-Way if the text defeats it.
+ *
+ * SEARCHING THE WHOLE BUFFER, NOT LINE BY LINE
+ * Reading one line at a time with `fgets()` means that for every line we copy it,
+ * look for its end, call `strlen()`, and start a fresh search. In a file of short
+ * lines, that overhead costs more than the search itself, and the fast engines
+ * never get a long stretch of text to race through. So we turn it around:
+ * 1. Read the file in big blocks of 1 MiB with `fread()`.
+ * 2. Run the search engine over the WHOLE block in one go.
+ * 3. Only when it finds a match do we look for the line around it: `memrchr()`
+ *    searches backwards for the '\n' before the match (the line start), and
+ *    `memchr()` forwards for the '\n' after it (the line end). We print that line
+ *    and continue the search right after it, so each line is printed once.
+ * Lines without a match are never looked at one by one at all. A block usually
+ * ends in the middle of a line, so we keep that unfinished line and move it to
+ * the front of the buffer before reading the next block.
+ *
+ * LINES OF ANY LENGTH: A GROWABLE BUFFER
+ * A fixed buffer would have to cut a line that is longer than the buffer, and a
+ * match across the cut would be missed. Log files with 100 KB JSON lines are
+ * common, so our buffer GROWS instead: whenever the unfinished line leaves less
+ * than a block of free space, we `realloc()` the buffer to TWICE its size. Because
+ * it doubles, a line of n bytes causes only about log2(n) reallocations and at
+ * most 2n bytes of copying in total (AMORTIZED growth). Two rules keep it cheap:
+ * - NO RESCANNING: a line is only searched once it is complete, and the search
+ *   for the last '\n' only looks at the newly read bytes.
+ * - BOUNDED MEMORY: the buffer only grows while a single line does not fit, so
+ *   it stays below about twice the longest line plus a block, however big the
+ *   file is.
+ *
+ * SEARCHING WHOLE DIRECTORY TREES IN PARALLEL
+ * Give the program a directory (or several paths) and it searches every file
+ * below it, printing each match as "path:line". A source tree has thousands of
+ * small files, and one thread would spend most of its time waiting for the disk
+ * and the kernel, so a POOL of WORKER THREADS (one per CPU) shares the job:
+ * - A shared WORK STACK holds the files and directories still to do. A worker pops
+ *   one. For a directory it reads the entries (`opendir()`/`readdir()`) and pushes
+ *   them as new work, so the directory walk itself is spread over the threads too.
+ *   For a file it runs the search.
+ * - Workers finish in any order, but the output must not depend on luck. So each
+ *   file's matches go into its own in-memory OUTPUT BUFFER (`open_memstream()`),
+ *   and the main thread prints the buffers in name order, waiting where a file is
+ *   not done yet.
+ * - BINARY FILES (programs, images, archives) are skipped. Text never contains a
+ *   NUL byte, so if the first 64 KiB has one, we stop reading right there.
+ * Because the program now uses threads, it must be compiled with `-pthread`.
+ *
+ * MANY PATTERNS AT ONCE: AHO-CORASICK (`-f patterns.txt`)
+ * Searching a log for 5,000 suspicious strings one at a time means reading it
+ * 5,000 times. The AHO-CORASICK algorithm (1975) reads the text ONCE for all of
+ * them. It builds a machine, a DFA (deterministic finite automaton), from the
+ * patterns:
+ * 1. Put all patterns in a TRIE: a tree where each edge is one byte and each path
+ *    from the root spells a pattern prefix. Each tree node is a STATE.
+ * 2. Add FAILURE LINKS: if the text stops following the tree, jump to the state
+ *    for the longest suffix of what we read that is still a prefix of some
+ *    pattern. We pre-compute these jumps into the table, so reading a byte is
+ *    always exactly ONE table lookup: `state = next[state + class[byte]]`.
+ * Two tricks keep the table small and fast. BYTE CLASSES: all bytes that appear in
+ * no pattern act the same, so they share one column, and a row only needs a few
+ * dozen entries instead of 256. And the states where a pattern ends are numbered
+ * LAST, so "did we find something?" is one comparison per byte. Each printed line
+ * starts with the pattern that was found in it, like "[pattern] line".
+ *
+ * REGULAR EXPRESSIONS (`-E regex`): FROM PATTERN TO MACHINE
+ * `-E` takes a regular expression with `. [a-z] [^0-9] \d \w \s ^ $ ( | ) * + ?`
+ * and `{m,n}`. Backtracking matchers (like Perl's) can take EXPONENTIAL time on
+ * patterns such as "(a|aa)*b". Ours never does. It works in three stages:
+ * 1. PARSE the pattern into a tree (an AST): "ab|c" becomes ALTERNATE(CONCAT(a, b), c).
+ * 2. Turn the tree into a THOMPSON NFA (Ken Thompson, 1968): a small graph of
+ *    states where each state matches one byte set or SPLITs into two paths. An NFA
+ *    can be in MANY states at once, and following all of them together in one pass
+ *    takes time linear in the text.
+ * 3. Following a whole SET of states for every byte is slow, so we build a LAZY DFA:
+ *    each set of NFA states we meet becomes one DFA state, and its next state for
+ *    a byte is worked out the first time we need it and CACHED in a table. After
+ *    that, each byte costs one table lookup, just like Aho-Corasick. The cache is
+ *    BOUNDED (2048 states). A nasty pattern like "(a|b)*a(a|b){12}" has thousands
+ *    of DFA states; when the cache fills up, we fall back to stepping the NFA
+ *    directly. That is slower, but the memory stays bounded and the time linear.
+ * Most real patterns contain plain text. In "ERROR: [0-9]+ retries", every match
+ * must contain "ERROR: " and " retries". We extract the longest such REQUIRED
+ * LITERAL and let the fast literal engine find it first (a PREFILTER). Only the
+ * lines where it shows up go through the DFA. A pattern with no special
+ * characters at all skips the DFA entirely.
+ *
+ * IGNORING CASE (`-i`) WITHOUT COPYING THE TEXT
+ * The obvious way to ignore case is to lowercase every line and then search it.
+ * That writes a copy of the whole file and reads it again, which can cost more
+ * than the search itself. Instead we lowercase only the PATTERN, once, and teach
+ * each engine to see the text in lowercase as it reads it. In ASCII, 'A' (0x41)
+ * and 'a' (0x61) differ in a single bit, 0x20:
+ * - The SIMD filter ORs 0x20 into each block of text before comparing it with a
+ *   lowercase letter. That is one extra instruction per 32 bytes.
+ * - Horspool's skip table gets the same entry for 'Q' as for 'q', and Two-Way
+ *   compares text bytes through a 256-entry FOLD TABLE.
+ * - Aho-Corasick gives 'A' and 'a' the same byte class, so its scan loop does not
+ *   change at all. Regular expressions put both cases in every byte set, and the
+ *   DFA does not change either.
+ * No line is ever copied, and `-i` runs at about the same speed as a normal search.
+ * Only the ASCII letters are folded: 'É' and 'é' still count as different.
+ *
+ * A TRIGRAM INDEX FOR REPEATED SEARCHES (`--index`)
+ * Searching the same big directory a hundred times a day reads every byte a
+ * hundred times. Search engines avoid that with an INDEX, built once. Ours is a
+ * TRIGRAM index, the design of Google Code Search:
+ * - A TRIGRAM is 3 bytes in a row. "printf" holds "pri", "rin", "int" and "ntf".
+ * - `--index build DIR` reads every file once and records, for each trigram, the
+ *   list of files that contain it: its POSTING LIST.
+ * - `--indexed PATTERN` looks up the trigrams of the pattern. Only a file that
+ *   contains ALL of them can match, so we INTERSECT their posting lists. That
+ *   leaves a short list of CANDIDATE files, and only those are searched (to rule
+ *   out files that have the trigrams but not the whole pattern).
+ * Posting lists are COMPRESSED: files are numbered, each list is sorted, and we
+ * store the GAPS between numbers as VARINTS (7 bits per byte). Most gaps are small
+ * and take one byte. The index is saved in the file `.grep_index` in the current
+ * directory.
+ * Building again is INCREMENTAL: a file whose size and modification time have not
+ * changed keeps its trigrams from the old index, so only new and changed files
+ * are read. A search always checks those two values too, and searches a file that
+ * changed since the index was built, whatever the index says. It also walks the
+ * directory for NEW files that the index does not list yet, and searches those
+ * too. Patterns shorter than 3 bytes have no trigrams, so they search every file.
+ *
+ * ONE HUGE FILE, MANY THREADS
+ * A directory gives every worker its own files, but a single 50 GB log would
+ * still be read by one thread. So a file of 32 MiB or more is split up instead:
+ * - `mmap()` maps the whole file into memory, so every thread can read any part
+ *   of it without copying.
+ * - The file is cut into CHUNKS of about 8 MiB. Each chunk ends right after a
+ *   '\n', so it holds whole lines only and no match can cross into the next one.
+ * - The workers take the chunks in file order, each writing its matching lines
+ *   into the chunk's own output buffer. The main thread prints the buffers in
+ *   file order, so the output is exactly what one thread would have printed.
+ * - A worker may only run a few chunks ahead of the printing, so a file where
+ *   every line matches does not pile up in memory.
+ * COUNTING (`-c`) prints only the number of matching lines. The order does not
+ * matter for a sum, so there the workers never wait: each one adds its chunk's
+ * count to the total.
+ *
+ * FINDING TYPOS: APPROXIMATE MATCHING (`--fuzzy=k`)
+ * A log that says "conection refused" is missed by a search for "connection".
+ * `--fuzzy=k` finds the pattern with up to k ERRORS, where an error is one byte
+ * inserted, deleted or replaced (the EDIT DISTANCE, or Levenshtein distance).
+ * - The textbook way fills a table with one row per pattern byte and one column
+ *   per text byte, and each cell costs a few comparisons. MYERS' BIT-PARALLEL
+ *   algorithm (1999) notices that neighbouring cells differ by only -1, 0 or +1.
+ *   So it stores a whole column as two BIT VECTORS of those differences, and
+ *   computes the next column with about 15 word operations, one of them an
+ *   addition that carries a run of matches down the column. A pattern of up to
+ *   64 bytes fits in one 64-bit word: one text byte, one column, a few
+ *   instructions. Longer patterns (up to 1024 bytes) use several words per
+ *   column, passing a carry from one word to the next.
+ * - THE PIGEONHOLE FILTER: cut the pattern into k + 1 pieces. k errors cannot
+ *   touch all k + 1 of them, so every match contains one piece EXACTLY.
+ *   Aho-Corasick looks for the pieces at full speed, and only the lines where one
+ *   shows up are checked with Myers. When the pieces would be shorter than 3
+ *   bytes, they would match almost everywhere, so we scan all the text with Myers.
+ *
+ * PRINTING FAST, AND STOPPING EARLY (`-c`, `-l`, `-m N`)
+ * When most lines match, printing can cost more than searching. Every `write()`
+ * is a SYSTEM CALL into the kernel, and `printf()` on a pipe makes one for every
+ * 4 KiB or so. So our results go into one big 256 KiB OUTPUT BUFFER, written
+ * with a single `write()` when it is full. A worker's finished output is not even
+ * copied into it: `writev()` sends the buffer AND the worker's bytes in the same
+ * system call.
+ * Often we do not need the lines at all, so we can do less work:
+ * - `-c` COUNTS the matching lines. The line around a match is never extracted
+ *   or printed; we only skip to its end.
+ * - `-l` LISTS the files that match. One match is enough, so we stop reading a
+ *   file at its first match.
+ * - `-m N` stops reading a file after N matching lines.
+ * Stopping early only pays off when we read the file from the start, so `-l` and
+ * `-m` do not split a big file between threads.
+ *
  * Let's get started!
  */
 
-// --- Required Headers ---
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h> // We need this for strstr()
+// Ask the C library for its POSIX and GNU extras too (memrchr, open_memstream,
+// lstat and `d_type`). This must come before the first #include.
+#define _GNU_SOURCE
+
+// --- Required Headers ---
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> // For strstr(), memmem(), memchr(), memrchr() and memcmp()
+#include <time.h>   // For clock(), used by `--bench`
+#include <errno.h>  // For errno after a failed fopen() or opendir()
+#include <pthread.h>  // For the worker threads that search directories
+#include <dirent.h>   // For opendir() and readdir()
+#include <sys/stat.h> // For stat() and lstat(): is a path a file or a directory?
+#include <sys/mman.h> // For mmap(): one big file is split between threads in memory
+#include <sys/uio.h>  // For writev(): several buffers written in one system call
+#include <unistd.h>   // For sysconf(), the number of CPUs
+
+// The SIMD filter needs x86-64 and a compiler (GCC or Clang) that can build single
+// functions for AVX2 and check the CPU at run time.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AVX2_FILTER 1
+#include <immintrin.h> // AVX2 vector intrinsics
+#endif
+
+// --- The Search Engine ---
+typedef enum
+{
+    SEARCH_MEMCHR,   // Single-byte patterns
+    SEARCH_TWO_WAY,  // Short patterns, and a linear-time fallback for Horspool
+    SEARCH_HORSPOOL, // Long patterns
+    SEARCH_MEMMEM,   // Two or more bytes without AVX2: the C library's tuned search
+    SEARCH_SIMD,     // Any pattern of two or more bytes, when the CPU has AVX2
+} SearchAlgorithm;
+
+#define HORSPOOL_MIN_LENGTH 8 // Shorter patterns skip too little for Horspool to win
+
+int g_use_simd = 1;   // Cleared when the CPU lacks AVX2 (and by `--bench`, to compare)
+int g_use_memmem = 1; // Cleared by `--bench`, to time Two-Way and Horspool
+
+// Everything we learn about the pattern before the search starts.
+typedef struct
+{
+    const unsigned char *pattern;
+    long length;
+    SearchAlgorithm algorithm;
+    long skip[256]; // Horspool: how far to jump when the window ends in this byte
+    long critical;  // Two-Way: the left half is pattern[0..critical-1]
+    long period;    // Two-Way: the pattern's period (or a safe shift if not periodic)
+    int periodic;   // Two-Way: true when the left half repeats inside the right half
+    long rare_first;  // SIMD: offsets of the two rarest pattern bytes,
+    long rare_second; // with rare_first < rare_second
+    int ignore_case;  // `-i`: the pattern is in lowercase, and text bytes go through `fold`
+    unsigned char fold[256]; // Text byte -> the byte we compare with the pattern
+} Searcher;
+
+// `-i` folds ASCII only: 'A'..'Z' and 'a'..'z' differ in just one bit, 0x20.
+int is_ascii_letter(unsigned char c)
+{
+    return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+unsigned char fold_byte(unsigned char c)
+{
+    return is_ascii_letter(c) ? (unsigned char)(c | 0x20) : c;
+}
+
+// Turns `text` into lowercase, in place.
+void fold_case(char *text, long length)
+{
+    for (long i = 0; i < length; i++)
+    {
+        text[i] = (char)fold_byte((unsigned char)text[i]);
+    }
+}
+
+// Roughly how common each byte is in English text and source code, most common
+// first. Bytes that are not listed are treated as the rarest of all.
+const char COMMON_BYTES[] = " etaoinsrhldcumfpgwybvk\nxjqzETAOINSRHLDCUMFPGWYBVKXJQZ"
+                            "0123456789_.,;:()=\"'-/{}*<>[]#+&!|?%$@\\^~`\t";
+
+int byte_rarity(unsigned char c)
+{
+    const char *found = c != '\0' ? strchr(COMMON_BYTES, c) : NULL;
+    return found ? (int)(found - COMMON_BYTES) : 255;
+}
+
+// Picks the offsets of the two rarest bytes in the pattern for the SIMD filter.
+void pick_rare_bytes(Searcher *searcher)
+{
+    if (searcher->length == 1)
+    {
+        searcher->rare_first = searcher->rare_second = 0;
+        return;
+    }
+    // The rarest byte, then the rarest of the others.
+    long first = 0;
+    for (long i = 1; i < searcher->length; i++)
+    {
+        if (byte_rarity(searcher->pattern[i]) > byte_rarity(searcher->pattern[first]))
+        {
+            first = i;
+        }
+    }
+    long second = first == 0 ? 1 : 0;
+    for (long i = 0; i < searcher->length; i++)
+    {
+        if (i != first && byte_rarity(searcher->pattern[i]) > byte_rarity(searcher->pattern[second]))
+        {
+            second = i;
+        }
+    }
+    searcher->rare_first = first < second ? first : second;
+    searcher->rare_second = first < second ? second : first;
+}
+
+// Finds the start of the lexicographically MAXIMAL SUFFIX of the pattern and its
+// period. With `reversed`, the byte order is flipped. Two-Way takes whichever of
+// the two suffixes starts later as its critical position.
+long maximal_suffix(const unsigned char *pattern, long length, int reversed, long *period)
+{
+    long start = -1; // One before the suffix found so far
+    long j = 0;
+    long k = 1;
+    *period = 1;
+
+    while (j + k < length)
+    {
+        unsigned char a = pattern[j + k];
+        unsigned char b = pattern[start + k];
+        if (reversed ? a > b : a < b)
+        {
+            j += k;
+            k = 1;
+            *period = j - start;
+        }
+        else if (a == b)
+        {
+            if (k != *period)
+            {
+                k++;
+            }
+            else
+            {
+                j += *period;
+                k = 1;
+            }
+        }
+        else
+        {
+            start = j;
+            j = start + 1;
+            k = *period = 1;
+        }
+    }
+    return start;
+}
+
+void two_way_prepare(Searcher *searcher)
+{
+    long period, reversed_period;
+    long suffix = maximal_suffix(searcher->pattern, searcher->length, 0, &period);
+    long reversed_suffix = maximal_suffix(searcher->pattern, searcher->length, 1, &reversed_period);
+
+    if (reversed_suffix > suffix)
+    {
+        suffix = reversed_suffix;
+        period = reversed_period;
+    }
+    searcher->critical = suffix + 1;
+
+    // The pattern is PERIODIC when its left half reappears `period` bytes later.
+    // Then a full match lets us remember how much of the next window already matches.
+    searcher->periodic = memcmp(searcher->pattern, searcher->pattern + period, (size_t)searcher->critical) == 0;
+    if (searcher->periodic)
+    {
+        searcher->period = period;
+    }
+    else
+    {
+        long left = searcher->critical;
+        long right = searcher->length - searcher->critical;
+        searcher->period = (left > right ? left : right) + 1;
+    }
+}
+
+// Prepares a search for `pattern` (which must not be empty). With `ignore_case`,
+// the pattern must already be in lowercase (see fold_case()).
+void searcher_init(Searcher *searcher, const char *pattern, long length, int ignore_case)
+{
+    searcher->pattern = (const unsigned char *)pattern;
+    searcher->length = length;
+    searcher->ignore_case = ignore_case;
+    for (int c = 0; c < 256; c++)
+    {
+        searcher->fold[c] = ignore_case ? fold_byte((unsigned char)c) : (unsigned char)c;
+    }
+
+    // memchr() only knows one byte value, so a letter with `-i` takes the long way.
+    if (length == 1 && !(ignore_case && is_ascii_letter(searcher->pattern[0])))
+    {
+        searcher->algorithm = SEARCH_MEMCHR;
+        return;
+    }
+
+    // Every searcher gets the Two-Way tables, since the others may fall back to them.
+    two_way_prepare(searcher);
+    searcher->algorithm = length >= HORSPOOL_MIN_LENGTH ? SEARCH_HORSPOOL : SEARCH_TWO_WAY;
+    // memmem() cannot ignore case, but with `-i` a pattern without letters
+    // matches the same bytes either way.
+    int has_letter = 0;
+    for (long i = 0; i < length && ignore_case; i++)
+    {
+        has_letter |= is_ascii_letter(searcher->pattern[i]);
+    }
+    if (g_use_memmem && !has_letter)
+    {
+        searcher->algorithm = SEARCH_MEMMEM;
+    }
+    pick_rare_bytes(searcher);
+#if defined(HAVE_AVX2_FILTER)
+    if (g_use_simd && __builtin_cpu_supports("avx2"))
+    {
+        searcher->algorithm = SEARCH_SIMD;
+    }
+#endif
+
+    // Horspool's skip table: a byte that is not in the pattern lets the window
+    // jump past it completely. Otherwise we jump just far enough to line it up
+    // with its last occurrence in the pattern (not counting the final byte).
+    for (int c = 0; c < 256; c++)
+    {
+        searcher->skip[c] = length;
+    }
+    for (long i = 0; i < length - 1; i++)
+    {
+        unsigned char c = searcher->pattern[i];
+        searcher->skip[c] = length - 1 - i;
+        if (ignore_case && is_ascii_letter(c))
+        {
+            searcher->skip[c ^ 0x20] = length - 1 - i; // The uppercase letter jumps the same
+        }
+    }
+}
+
+// Is the pattern at `text`? With `-i`, every text byte is folded first.
+int pattern_equals(const Searcher *searcher, const unsigned char *text, long length)
+{
+    if (!searcher->ignore_case)
+    {
+        return memcmp(text, searcher->pattern, (size_t)length) == 0;
+    }
+    for (long i = 0; i < length; i++)
+    {
+        if (searcher->fold[text[i]] != searcher->pattern[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const char *two_way_find(const Searcher *searcher, const unsigned char *text, long text_length)
+{
+    const unsigned char *pattern = searcher->pattern;
+    const unsigned char *fold = searcher->fold;
+    long length = searcher->length;
+    long critical = searcher->critical;
+    long memory = 0; // Bytes at the start of the window already known to match
+    long position = 0;
+    int use_memchr = !searcher->ignore_case || !is_ascii_letter(pattern[critical]);
+
+    while (position <= text_length - length)
+    {
+        // The first byte we compare is pattern[critical]. When nothing is carried
+        // over from the last window, let memchr() jump straight to the next place
+        // where that byte occurs. This only skips windows that cannot match.
+        if (memory == 0 && !use_memchr)
+        {
+            // Either case of the letter will do, so we look byte by byte.
+            while (position <= text_length - length && fold[text[position + critical]] != pattern[critical])
+            {
+                position++;
+            }
+            if (position > text_length - length)
+            {
+                return NULL;
+            }
+        }
+        else if (memory == 0)
+        {
+            const unsigned char *next = memchr(text + position + critical, pattern[critical],
+                                               (size_t)(text_length - length - position + 1));
+            if (!next)
+            {
+                return NULL;
+            }
+            position = next - text - critical;
+        }
+
+        // Compare the right half, left to right.
+        long i = critical > memory ? critical : memory;
+        while (i < length && pattern[i] == fold[text[position + i]])
+        {
+            i++;
+        }
+        if (i < length)
+        {
+            position += i - critical + 1;
+            memory = 0;
+            continue;
+        }
+
+        // Then the left half, right to left.
+        i = critical;
+        while (i > memory && pattern[i - 1] == fold[text[position + i - 1]])
+        {
+            i--;
+        }
+        if (i <= memory)
+        {
+            return (const char *)text + position;
+        }
+        position += searcher->period;
+        memory = searcher->periodic ? length - searcher->period : 0;
+    }
+    return NULL;
+}
+
+const char *horspool_find(const Searcher *searcher, const unsigned char *text, long text_length)
+{
+    const unsigned char *pattern = searcher->pattern;
+    long length = searcher->length;
+    unsigned char last = pattern[length - 1];
+    long position = 0;
+    long compared = 0; // Bytes spent on full comparisons so far
+
+    while (position <= text_length - length)
+    {
+        unsigned char c = text[position + length - 1];
+        if (searcher->fold[c] == last)
+        {
+            if (pattern_equals(searcher, text + position, length - 1))
+            {
+                return (const char *)text + position;
+            }
+
+            // A healthy search rarely compares more than it skips. If comparing
+            // starts to dominate, switch to Two-Way for a linear worst case.
+            compared += length;
+            if (compared > 4 * position + 64 * length)
+            {
+                return two_way_find(searcher, text + position, text_length - position);
+            }
+        }
+        position += searcher->skip[c];
+    }
+    return NULL;
+}
+
+#if defined(HAVE_AVX2_FILTER)
+// The SIMD candidate filter. `target("avx2")` lets the compiler use AVX2 in this
+// one function, even though the rest of the program is built for any x86-64 CPU.
+__attribute__((target("avx2")))
+const char *simd_find(const Searcher *searcher, const unsigned char *text, long text_length)
+{
+    const unsigned char *pattern = searcher->pattern;
+    long length = searcher->length;
+    long first = searcher->rare_first;
+    long second = searcher->rare_second;
+    __m256i want_first = _mm256_set1_epi8((char)pattern[first]);
+    __m256i want_second = _mm256_set1_epi8((char)pattern[second]);
+    // With `-i`, setting bit 0x20 of every text byte turns 'Q' into 'q', so one
+    // compare finds both cases. Only for letters: other bytes must match exactly.
+    __m256i case_first = _mm256_set1_epi8(searcher->ignore_case && is_ascii_letter(pattern[first]) ? 0x20 : 0);
+    __m256i case_second = _mm256_set1_epi8(searcher->ignore_case && is_ascii_letter(pattern[second]) ? 0x20 : 0);
+    long position = 0;
+    long verified = 0; // Candidates checked in full so far
+
+    // Each step tests the 32 windows starting at position..position+31. The loop
+    // stops while every byte those windows need is still inside the text.
+    while (position + 31 + length <= text_length)
+    {
+        // The hot loop only looks for a block with at least one candidate. Keeping
+        // memcmp() out of it lets the compiler hold everything in registers.
+        unsigned int candidates = 0;
+        for (; position + 31 + length <= text_length; position += 32)
+        {
+            __m256i block_first = _mm256_or_si256(
+                _mm256_loadu_si256((const __m256i *)(text + position + first)), case_first);
+            __m256i block_second = _mm256_or_si256(
+                _mm256_loadu_si256((const __m256i *)(text + position + second)), case_second);
+            __m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(block_first, want_first),
+                                            _mm256_cmpeq_epi8(block_second, want_second));
+            candidates = (unsigned int)_mm256_movemask_epi8(both);
+            if (candidates != 0)
+            {
+                break;
+            }
+        }
+        if (candidates == 0)
+        {
+            break; // Reached the end of the text without a candidate.
+        }
+
+        while (candidates != 0)
+        {
+            long start = position + __builtin_ctz(candidates); // Lowest set bit = earliest window
+            if (pattern_equals(searcher, text + start, length))
+            {
+                return (const char *)text + start;
+            }
+            candidates &= candidates - 1; // Clear that bit
+
+            // Too many false candidates (e.g. "aa" in "aaaa..."): go linear.
+            verified += length;
+            if (verified > 4 * position + 64 * length)
+            {
+                return two_way_find(searcher, text + start + 1, text_length - start - 1);
+            }
+        }
+        position += 32;
+    }
+
+    // The last few windows, too close to the end for a 32-byte load.
+    return two_way_find(searcher, text + position, text_length - position);
+}
+#endif
+
+// Returns a pointer to the first occurrence of the pattern in `text[0..text_length-1]`,
+// or NULL. Unlike strstr(), the text does not need to end with '\0'.
+const char *searcher_find(const Searcher *searcher, const char *text, long text_length)
+{
+    switch (searcher->algorithm)
+    {
+    case SEARCH_MEMCHR:
+        return memchr(text, searcher->pattern[0], (size_t)text_length);
+    case SEARCH_TWO_WAY:
+        return two_way_find(searcher, (const unsigned char *)text, text_length);
+    case SEARCH_HORSPOOL:
+        return horspool_find(searcher, (const unsigned char *)text, text_length);
+    case SEARCH_MEMMEM:
+        return memmem(text, (size_t)text_length, searcher->pattern, (size_t)searcher->length);
+    case SEARCH_SIMD:
+#if defined(HAVE_AVX2_FILTER)
+        return simd_find(searcher, (const unsigned char *)text, text_length);
+#else
+        break; // Never chosen without AVX2 support.
+#endif
+    }
+    return NULL;
+}
+
+const char *algorithm_name(SearchAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case SEARCH_MEMCHR:
+        return "memchr";
+    case SEARCH_TWO_WAY:
+        return "two-way";
+    case SEARCH_HORSPOOL:
+        return "horspool";
+    case SEARCH_MEMMEM:
+        return "memmem";
+    case SEARCH_SIMD:
+        return "simd";
+    }
+    return "?";
+}
+
+// --- Many Patterns at Once: Aho-Corasick `-f` ---
+
+// Everything the Aho-Corasick automaton needs. A STATE stands for "the longest
+// pattern prefix that the text read so far ends with". States are numbered so
+// that the MATCH STATES (where a whole pattern ends) come last: the scan loop
+// then spots a match with a single comparison, `state >= first_match`.
+typedef struct
+{
+    char **patterns; // The patterns, one per line of the `-f` file
+    long *lengths;
+    long count;
+    unsigned char classes[256]; // Byte -> column in `next`; 0 for bytes in no pattern
+    long class_count;
+    int *next;        // next[state + class] is the next state. States are stored
+                      // pre-multiplied by `class_count`, so no multiply is needed
+    int *match;       // For match state s: the pattern found, at match[s / class_count - first]
+    long state_count;
+    int first_match;  // The first match state, also pre-multiplied
+} PatternSet;
+
+// Reads one pattern per line from `filename`. Empty lines are ignored. Returns 0,
+// or 1 after printing an error message.
+int pattern_set_load(PatternSet *set, const char *filename)
+{
+    memset(set, 0, sizeof(*set));
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror("Error opening pattern file");
+        return 1;
+    }
+
+    // `getline()` reads a whole line of any length into a buffer that it grows.
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    long capacity = 0;
+    int status = 0;
+    while ((length = getline(&line, &line_capacity, file)) != -1)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        {
+            length--; // Drop the line ending, Unix or Windows style.
+        }
+        if (length == 0)
+        {
+            continue;
+        }
+        if (set->count == capacity)
+        {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            char **bigger_patterns = realloc(set->patterns, (size_t)capacity * sizeof(char *));
+            if (bigger_patterns != NULL)
+            {
+                set->patterns = bigger_patterns;
+            }
+            long *bigger_lengths = realloc(set->lengths, (size_t)capacity * sizeof(long));
+            if (bigger_lengths != NULL)
+            {
+                set->lengths = bigger_lengths;
+            }
+            if (bigger_patterns == NULL || bigger_lengths == NULL)
+            {
+                status = 1;
+                break;
+            }
+        }
+        set->patterns[set->count] = malloc((size_t)length + 1);
+        if (set->patterns[set->count] == NULL)
+        {
+            status = 1;
+            break;
+        }
+        memcpy(set->patterns[set->count], line, (size_t)length);
+        set->patterns[set->count][length] = '\0';
+        set->lengths[set->count] = length;
+        set->count++;
+    }
+    free(line);
+    fclose(file);
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Error: out of memory while reading %s\n", filename);
+    }
+    else if (set->count == 0)
+    {
+        fprintf(stderr, "Error: %s contains no patterns.\n", filename);
+        status = 1;
+    }
+    return status;
+}
+
+// Builds the automaton. Returns 0, or 1 if there is not enough memory.
+int pattern_set_build(PatternSet *set, int ignore_case)
+{
+    // BYTE CLASSES: bytes that appear in no pattern all behave the same, so they
+    // share column 0. With text patterns this shrinks each table row from 256
+    // entries to a few dozen, and far more of the table fits in the CPU cache.
+    // With `-i`, 'A' and 'a' share a class: the automaton cannot tell them apart,
+    // and ignoring case costs nothing at all while searching.
+    long classes = 1;
+    long max_states = 1;
+    for (long i = 0; i < set->count; i++)
+    {
+        for (long j = 0; j < set->lengths[i]; j++)
+        {
+            unsigned char c = (unsigned char)set->patterns[i][j];
+            if (set->classes[c] == 0)
+            {
+                set->classes[c] = (unsigned char)classes;
+                if (ignore_case && is_ascii_letter(c))
+                {
+                    set->classes[c ^ 0x20] = (unsigned char)classes;
+                }
+                classes++;
+            }
+        }
+        max_states += set->lengths[i];
+    }
+    if (max_states * classes > 0x7FFFFFFF)
+    {
+        fprintf(stderr, "Error: the pattern file is too big.\n");
+        return 1;
+    }
+
+    // The patterns' total length bounds the number of states, so we can allocate
+    // everything up front.
+    int *next = calloc((size_t)(max_states * classes), sizeof(int));
+    int *found = malloc((size_t)max_states * sizeof(int)); // Pattern ending here, or -1
+    int *fail = calloc((size_t)max_states, sizeof(int));
+    int *queue = malloc((size_t)max_states * sizeof(int));
+    int *renumbered = malloc((size_t)max_states * sizeof(int));
+    set->next = malloc((size_t)(max_states * classes) * sizeof(int));
+    set->match = malloc((size_t)max_states * sizeof(int));
+    if (next == NULL || found == NULL || fail == NULL || queue == NULL || renumbered == NULL ||
+        set->next == NULL || set->match == NULL)
+    {
+        fprintf(stderr, "Error: out of memory while building the pattern automaton\n");
+        free(next);
+        free(found);
+        free(fail);
+        free(queue);
+        free(renumbered);
+        free(set->next);
+        free(set->match);
+        set->next = NULL;
+        set->match = NULL;
+        return 1;
+    }
+
+    // Step 1: the TRIE. Every pattern is a path from the start state 0. A zero
+    // entry in `next` means "no edge yet" (no edge ever leads back to state 0).
+    long states = 1;
+    found[0] = -1;
+    for (long i = 0; i < set->count; i++)
+    {
+        long state = 0;
+        for (long j = 0; j < set->lengths[i]; j++)
+        {
+            long slot = state * classes + set->classes[(unsigned char)set->patterns[i][j]];
+            if (next[slot] == 0)
+            {
+                found[states] = -1;
+                next[slot] = (int)states++;
+            }
+            state = next[slot];
+        }
+        if (found[state] < 0)
+        {
+            found[state] = (int)i; // A repeated pattern keeps its first line.
+        }
+    }
+
+    // Step 2: FAILURE LINKS, breadth first. fail[s] is the state for the longest
+    // proper suffix of s's text that is also a pattern prefix. Every missing edge
+    // is filled in with the failure state's edge, which turns the trie into a DFA:
+    // exactly one table lookup per text byte, and no backtracking.
+    long head = 0;
+    long tail = 0;
+    for (long c = 0; c < classes; c++)
+    {
+        if (next[c] != 0)
+        {
+            queue[tail++] = next[c]; // fail[] of the depth-1 states is 0 already.
+        }
+    }
+    while (head < tail)
+    {
+        long state = queue[head++];
+        if (found[state] < 0)
+        {
+            found[state] = found[fail[state]]; // A shorter pattern may end here.
+        }
+        for (long c = 0; c < classes; c++)
+        {
+            long slot = state * classes + c;
+            if (next[slot] != 0)
+            {
+                fail[next[slot]] = next[fail[state] * classes + c];
+                queue[tail++] = next[slot];
+            }
+            else
+            {
+                next[slot] = next[fail[state] * classes + c];
+            }
+        }
+    }
+
+    // Step 3: renumber the states, non-matching ones (starting with state 0) first.
+    long non_matching = 0;
+    for (long s = 0; s < states; s++)
+    {
+        non_matching += found[s] < 0;
+    }
+    long next_plain = 0;
+    long next_match = non_matching;
+    for (long s = 0; s < states; s++)
+    {
+        renumbered[s] = (int)(found[s] < 0 ? next_plain++ : next_match++);
+    }
+
+    for (long s = 0; s < states; s++)
+    {
+        for (long c = 0; c < classes; c++)
+        {
+            set->next[renumbered[s] * classes + c] = (int)(renumbered[next[s * classes + c]] * classes);
+        }
+        if (found[s] >= 0)
+        {
+            set->match[renumbered[s] - non_matching] = found[s];
+        }
+    }
+    set->class_count = classes;
+    set->state_count = states;
+    set->first_match = (int)(non_matching * classes);
+
+    free(next);
+    free(found);
+    free(fail);
+    free(queue);
+    free(renumbered);
+    return 0;
+}
+
+// Returns a pointer to the start of the first pattern occurrence in the text
+// (the one that ENDS first), and stores which pattern it is in `*which`.
+const char *pattern_set_find(const PatternSet *set, const char *text, long text_length, long *which)
+{
+    const unsigned char *position = (const unsigned char *)text;
+    const unsigned char *end = position + text_length;
+    const int *next = set->next;
+    const unsigned char *classes = set->classes;
+    int first_match = set->first_match;
+    int state = 0;
+
+    for (; position < end; position++)
+    {
+        state = next[state + classes[*position]];
+        if (state >= first_match)
+        {
+            *which = set->match[(state - first_match) / set->class_count];
+            return (const char *)position + 1 - set->lengths[*which];
+        }
+    }
+    return NULL;
+}
+
+void pattern_set_free(PatternSet *set)
+{
+    for (long i = 0; i < set->count; i++)
+    {
+        free(set->patterns[i]);
+    }
+    free(set->patterns);
+    free(set->lengths);
+    free(set->next);
+    free(set->match);
+}
+
+// --- Regular Expressions `-E`: Parser, NFA and Lazy DFA ---
+#define REGEX_MAX_STATES 10000 // NFA size limit; "a{1000}{1000}" would need a million
+#define REGEX_MAX_DEPTH 100    // How deeply parentheses may nest
+#define REGEX_LITERAL_MAX 32   // Longest literal kept for the prefilter
+#define DFA_MAX_STATES 2048    // Per-thread DFA cache size (2048 * 256 * 4 bytes = 2 MiB)
+#define DFA_UNKNOWN (-1)       // Table entry: transition not computed yet
+#define DFA_MATCH (-2)         // Table entry: this byte completes a match
+#define SYMBOL_BOL 256         // The "start of line" symbol that `^` waits for
+#define SYMBOL_EOL 257         // The "end of line" symbol that `$` waits for
+
+// Step 1: the ABSTRACT SYNTAX TREE. "ab*|c" becomes ALTERNATE(CONCAT(a, REPEAT(b)), c).
+// Every single-byte item (a literal, `.`, `[a-z]`, `\d`) is a SET of allowed bytes.
+typedef enum
+{
+    NODE_EMPTY,     // Matches the empty string, e.g. "()"
+    NODE_SET,       // One byte from `set`
+    NODE_BOL,       // `^`
+    NODE_EOL,       // `$`
+    NODE_CONCAT,    // left, then right
+    NODE_ALTERNATE, // left or right
+    NODE_REPEAT,    // left, between `min` and `max` times (max -1: no limit)
+} RegexNodeKind;
+
+typedef struct RegexNode
+{
+    RegexNodeKind kind;
+    unsigned char set[32]; // NODE_SET: bit b is set if byte b matches
+    struct RegexNode *left;
+    struct RegexNode *right;
+    int min;
+    int max;
+} RegexNode;
+
+typedef struct
+{
+    const unsigned char *pattern;
+    long length;
+    long position;
+    int depth;
+    RegexNode *nodes; // Room for every node; each pattern byte makes at most 2
+    long node_count;
+    int has_anchors;
+    int ignore_case; // `-i`: "[^a-z]" must not match 'A' either, so fold before negating
+    const char *error;
+} RegexParser;
+
+void set_add(unsigned char *set, int c)
+{
+    set[c / 8] |= (unsigned char)(1 << (c % 8));
+}
+
+int set_has(const unsigned char *set, int c)
+{
+    return (set[c / 8] >> (c % 8)) & 1;
+}
+
+// `-i`: a set that holds a letter in one case gets the other case too.
+void set_fold_case(unsigned char *set)
+{
+    for (int c = 'a'; c <= 'z'; c++)
+    {
+        if (set_has(set, c) || set_has(set, c ^ 0x20))
+        {
+            set_add(set, c);
+            set_add(set, c ^ 0x20);
+        }
+    }
+}
+
+RegexNode *regex_node(RegexParser *parser, RegexNodeKind kind, RegexNode *left, RegexNode *right)
+{
+    RegexNode *node = &parser->nodes[parser->node_count++];
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+// Adds the bytes of a `\d`, `\w` or `\s` class (or their negations `\D`, `\W`, `\S`)
+// to `set`. Returns 0 if `letter` does not name a class.
+int add_class_escape(unsigned char *set, int letter)
+{
+    int lower = letter | 0x20; // 'D' -> 'd'
+    if (lower != 'd' && lower != 'w' && lower != 's')
+    {
+        return 0;
+    }
+    for (int c = 0; c < 256; c++)
+    {
+        int digit = c >= '0' && c <= '9';
+        int in_class = lower == 'd' ? digit
+                     : lower == 'w' ? digit || c == '_' || is_ascii_letter((unsigned char)c)
+                                    : c == ' ' || (c >= '\t' && c <= '\r');
+        if (in_class == (letter == lower)) // Lowercase: the class. Uppercase: all the rest.
+        {
+            set_add(set, c);
+        }
+    }
+    return 1;
+}
+
+// Reads one byte after a backslash: `\t`, or any other byte taken literally.
+int escaped_byte(int letter)
+{
+    return letter == 't' ? '\t' : letter;
+}
+
+RegexNode *parse_alternation(RegexParser *parser);
+
+// `[...]`: a bracket expression like [abc], [a-z0-9_] or [^"].
+RegexNode *parse_bracket(RegexParser *parser)
+{
+    RegexNode *node = regex_node(parser, NODE_SET, NULL, NULL);
+    int negate = 0;
+    if (parser->position < parser->length && parser->pattern[parser->position] == '^')
+    {
+        negate = 1;
+        parser->position++;
+    }
+
+    int first = 1;
+    while (parser->position < parser->length && (parser->pattern[parser->position] != ']' || first))
+    {
+        int c = parser->pattern[parser->position++];
+        first = 0;
+        if (c == '\\' && parser->position < parser->length)
+        {
+            int letter = parser->pattern[parser->position++];
+            if (add_class_escape(node->set, letter))
+            {
+                continue;
+            }
+            c = escaped_byte(letter);
+        }
+        int last = c;
+        if (parser->position + 1 < parser->length && parser->pattern[parser->position] == '-' &&
+            parser->pattern[parser->position + 1] != ']')
+        {
+            last = parser->pattern[parser->position + 1];
+            parser->position += 2;
+            if (last < c)
+            {
+                parser->error = "range out of order in [...]";
+                return NULL;
+            }
+        }
+        for (int b = c; b <= last; b++)
+        {
+            set_add(node->set, b);
+        }
+    }
+    if (parser->position >= parser->length)
+    {
+        parser->error = "missing ]";
+        return NULL;
+    }
+    parser->position++; // Skip the ']'.
+
+    if (parser->ignore_case)
+    {
+        set_fold_case(node->set);
+    }
+    if (negate)
+    {
+        for (int i = 0; i < 32; i++)
+        {
+            node->set[i] = (unsigned char)~node->set[i];
+        }
+    }
+    node->set['\n' / 8] &= (unsigned char)~(1 << ('\n' % 8)); // Never match across lines.
+    return node;
+}
+
+// An ATOM is a single item that a `*`, `+`, `?` or `{m,n}` can follow.
+RegexNode *parse_atom(RegexParser *parser)
+{
+    int c = parser->pattern[parser->position++];
+    switch (c)
+    {
+    case '(':
+    {
+        if (++parser->depth > REGEX_MAX_DEPTH)
+        {
+            parser->error = "parentheses nested too deeply";
+            return NULL;
+        }
+        RegexNode *inner = parse_alternation(parser);
+        parser->depth--;
+        if (inner == NULL)
+        {
+            return NULL;
+        }
+        if (parser->position >= parser->length || parser->pattern[parser->position] != ')')
+        {
+            parser->error = "missing )";
+            return NULL;
+        }
+        parser->position++;
+        return inner;
+    }
+    case '[':
+        return parse_bracket(parser);
+    case '^':
+        parser->has_anchors = 1;
+        return regex_node(parser, NODE_BOL, NULL, NULL);
+    case '$':
+        parser->has_anchors = 1;
+        return regex_node(parser, NODE_EOL, NULL, NULL);
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+        parser->error = "nothing to repeat";
+        return NULL;
+    }
+
+    RegexNode *node = regex_node(parser, NODE_SET, NULL, NULL);
+    if (c == '.')
+    {
+        memset(node->set, 0xFF, sizeof(node->set));
+        node->set['\n' / 8] &= (unsigned char)~(1 << ('\n' % 8));
+    }
+    else if (c == '\\')
+    {
+        if (parser->position >= parser->length)
+        {
+            parser->error = "trailing backslash";
+            return NULL;
+        }
+        int letter = parser->pattern[parser->position++];
+        if (!add_class_escape(node->set, letter))
+        {
+            set_add(node->set, escaped_byte(letter));
+        }
+        node->set['\n' / 8] &= (unsigned char)~(1 << ('\n' % 8));
+    }
+    else
+    {
+        set_add(node->set, c);
+    }
+    return node;
+}
+
+// Reads a number for `{m,n}`. Returns -1 if there is none.
+int parse_count(RegexParser *parser)
+{
+    int value = -1;
+    while (parser->position < parser->length && parser->pattern[parser->position] >= '0' &&
+           parser->pattern[parser->position] <= '9' && value < REGEX_MAX_STATES)
+    {
+        value = (value < 0 ? 0 : value * 10) + (parser->pattern[parser->position++] - '0');
+    }
+    return value;
+}
+
+// An atom followed by any number of `*`, `+`, `?` and `{m,n}`.
+RegexNode *parse_repeat(RegexParser *parser)
+{
+    RegexNode *node = parse_atom(parser);
+    while (node != NULL && parser->position < parser->length)
+    {
+        int c = parser->pattern[parser->position];
+        int min;
+        int max;
+        if (c == '*' || c == '+' || c == '?')
+        {
+            min = c == '+';
+            max = c == '?' ? 1 : -1;
+            parser->position++;
+        }
+        else if (c == '{')
+        {
+            parser->position++;
+            min = parse_count(parser);
+            max = min;
+            if (parser->position < parser->length && parser->pattern[parser->position] == ',')
+            {
+                parser->position++;
+                max = parse_count(parser);
+            }
+            if (min < 0 || parser->position >= parser->length || parser->pattern[parser->position] != '}' ||
+                (max >= 0 && max < min))
+            {
+                parser->error = "bad {m,n} repeat";
+                return NULL;
+            }
+            parser->position++;
+        }
+        else
+        {
+            break;
+        }
+        node = regex_node(parser, NODE_REPEAT, node, NULL);
+        node->min = min;
+        node->max = max;
+    }
+    return node;
+}
+
+// A sequence of repeats, up to `|`, `)` or the end.
+RegexNode *parse_concat(RegexParser *parser)
+{
+    RegexNode *result = NULL;
+    while (parser->position < parser->length && parser->pattern[parser->position] != '|' &&
+           parser->pattern[parser->position] != ')')
+    {
+        RegexNode *next = parse_repeat(parser);
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        result = result == NULL ? next : regex_node(parser, NODE_CONCAT, result, next);
+    }
+    return result != NULL ? result : regex_node(parser, NODE_EMPTY, NULL, NULL);
+}
+
+RegexNode *parse_alternation(RegexParser *parser)
+{
+    RegexNode *result = parse_concat(parser);
+    while (result != NULL && parser->position < parser->length && parser->pattern[parser->position] == '|')
+    {
+        parser->position++;
+        RegexNode *next = parse_concat(parser);
+        result = next == NULL ? NULL : regex_node(parser, NODE_ALTERNATE, result, next);
+    }
+    return result;
+}
+
+// Step 2: the THOMPSON NFA. Each state either consumes one symbol (a byte from
+// its set, the start of line, or the end of line) and moves to `out`, or is a
+// SPLIT that moves to BOTH `out` and `out1` without consuming anything.
+typedef enum
+{
+    NFA_SET,
+    NFA_BOL,
+    NFA_EOL,
+    NFA_SPLIT,
+    NFA_MATCH,
+} NfaKind;
+
+typedef struct
+{
+    NfaKind kind;
+    int out;
+    int out1;
+    unsigned char set[32];
+} NfaState;
+
+// A literal string that every match must contain, used as a PREFILTER.
+typedef struct
+{
+    unsigned char exact[REGEX_LITERAL_MAX];    // The whole match, if it is one fixed string
+    int exact_length;                          // -1 if the match is not a fixed string
+    unsigned char prefix[REGEX_LITERAL_MAX];   // Every match starts with this
+    int prefix_length;
+    unsigned char suffix[REGEX_LITERAL_MAX];   // Every match ends with this
+    int suffix_length;
+    unsigned char required[REGEX_LITERAL_MAX]; // Every match contains this
+    int required_length;
+} LiteralInfo;
+
+typedef struct
+{
+    NfaState *states;
+    int count;
+    int capacity;
+    int start;
+    int ignore_case; // `-i`: every byte set also holds the other case of its letters
+    int is_literal; // Matches one fixed string only: `required` does all the work
+    unsigned char required_text[REGEX_LITERAL_MAX];
+    Searcher required; // Finds candidate lines before the DFA looks at them
+    long required_length;
+} Regex;
+
+// Adds an NFA state. Returns its number, or -1 when the NFA is too big.
+int nfa_add(Regex *regex, NfaKind kind, int out, int out1, const unsigned char *set)
+{
+    if (regex->count == regex->capacity)
+    {
+        if (regex->capacity >= REGEX_MAX_STATES)
+        {
+            return -1;
+        }
+        int capacity = regex->capacity > 0 ? 2 * regex->capacity : 64;
+        NfaState *bigger = realloc(regex->states, (size_t)capacity * sizeof(NfaState));
+        if (bigger == NULL)
+        {
+            return -1;
+        }
+        regex->states = bigger;
+        regex->capacity = capacity;
+    }
+    NfaState *state = &regex->states[regex->count];
+    state->kind = kind;
+    state->out = out;
+    state->out1 = out1;
+    if (set != NULL)
+    {
+        memcpy(state->set, set, sizeof(state->set));
+        if (regex->ignore_case)
+        {
+            set_fold_case(state->set);
+        }
+    }
+    return regex->count++;
+}
+
+// Compiles `node` so that it continues to state `next` afterwards, and returns
+// its first state (or -1). Building back to front means no patching is needed.
+int nfa_compile(Regex *regex, const RegexNode *node, int next)
+{
+    if (next < 0)
+    {
+        return -1;
+    }
+    switch (node->kind)
+    {
+    case NODE_EMPTY:
+        return next;
+    case NODE_SET:
+        return nfa_add(regex, NFA_SET, next, -1, node->set);
+    case NODE_BOL:
+        return nfa_add(regex, NFA_BOL, next, -1, NULL);
+    case NODE_EOL:
+        return nfa_add(regex, NFA_EOL, next, -1, NULL);
+    case NODE_CONCAT:
+        return nfa_compile(regex, node->left, nfa_compile(regex, node->right, next));
+    case NODE_ALTERNATE:
+    {
+        int left = nfa_compile(regex, node->left, next);
+        int right = nfa_compile(regex, node->right, next);
+        return left < 0 || right < 0 ? -1 : nfa_add(regex, NFA_SPLIT, left, right, NULL);
+    }
+    case NODE_REPEAT:
+    {
+        // x{2,4} is compiled as x x (x (x)?)? and x{2,} as x x x*.
+        int tail = next;
+        if (node->max < 0)
+        {
+            int loop = nfa_add(regex, NFA_SPLIT, -1, next, NULL);
+            int body = loop < 0 ? -1 : nfa_compile(regex, node->left, loop);
+            if (body < 0)
+            {
+                return -1;
+            }
+            regex->states[loop].out = body;
+            tail = loop;
+        }
+        for (int i = node->min; i < node->max && tail >= 0; i++)
+        {
+            int body = nfa_compile(regex, node->left, tail);
+            tail = body < 0 ? -1 : nfa_add(regex, NFA_SPLIT, body, tail, NULL);
+        }
+        for (int i = 0; i < node->min && tail >= 0; i++)
+        {
+            tail = nfa_compile(regex, node->left, tail);
+        }
+        return tail;
+    }
+    }
+    return -1;
+}
+
+// Appends up to `length` bytes to a literal of at most REGEX_LITERAL_MAX bytes.
+// `keep_end` keeps the LAST bytes when it overflows, for suffixes.
+void literal_join(unsigned char *out, int *out_length, const unsigned char *a, int a_length,
+                  const unsigned char *b, int b_length, int keep_end)
+{
+    unsigned char joined[2 * REGEX_LITERAL_MAX];
+    memcpy(joined, a, (size_t)a_length);
+    memcpy(joined + a_length, b, (size_t)b_length);
+    int length = a_length + b_length;
+    int skip = keep_end && length > REGEX_LITERAL_MAX ? length - REGEX_LITERAL_MAX : 0;
+    *out_length = length - skip < REGEX_LITERAL_MAX ? length - skip : REGEX_LITERAL_MAX;
+    memmove(out, joined + skip, (size_t)*out_length);
+}
+
+void literal_keep_longer(LiteralInfo *info, const unsigned char *text, int length)
+{
+    if (length > info->required_length)
+    {
+        memcpy(info->required, text, (size_t)length);
+        info->required_length = length;
+    }
+}
+
+// Works out which literal strings every match of `node` must contain. For
+// "err(or|no)[0-9]+ timeout" that is "timeout" (and "err").
+void extract_literals(const RegexNode *node, LiteralInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->exact_length = -1;
+    switch (node->kind)
+    {
+    case NODE_EMPTY:
+    case NODE_BOL:
+    case NODE_EOL:
+        info->exact_length = 0;
+        return;
+    case NODE_SET:
+    {
+        int count = 0;
+        int only = 0;
+        for (int c = 0; c < 256; c++)
+        {
+            if (set_has(node->set, c))
+            {
+                count++;
+                only = c;
+            }
+        }
+        if (count == 1)
+        {
+            info->exact[0] = info->prefix[0] = info->suffix[0] = info->required[0] = (unsigned char)only;
+            info->exact_length = info->prefix_length = info->suffix_length = info->required_length = 1;
+        }
+        return;
+    }
+    case NODE_CONCAT:
+    {
+        LiteralInfo left;
+        LiteralInfo right;
+        extract_literals(node->left, &left);
+        extract_literals(node->right, &right);
+        if (left.exact_length >= 0 && right.exact_length >= 0 &&
+            left.exact_length + right.exact_length <= REGEX_LITERAL_MAX)
+        {
+            literal_join(info->exact, &info->exact_length, left.exact, left.exact_length,
+                         right.exact, right.exact_length, 0);
+        }
+        if (left.exact_length >= 0)
+        {
+            literal_join(info->prefix, &info->prefix_length, left.exact, left.exact_length,
+                         right.prefix, right.prefix_length, 0);
+        }
+        else
+        {
+            literal_join(info->prefix, &info->prefix_length, left.prefix, left.prefix_length, (const unsigned char *)"", 0, 0);
+        }
+        if (right.exact_length >= 0)
+        {
+            literal_join(info->suffix, &info->suffix_length, left.suffix, left.suffix_length,
+                         right.exact, right.exact_length, 1);
+        }
+        else
+        {
+            literal_join(info->suffix, &info->suffix_length, right.suffix, right.suffix_length, (const unsigned char *)"", 0, 1);
+        }
+        unsigned char middle[REGEX_LITERAL_MAX];
+        int middle_length;
+        literal_join(middle, &middle_length, left.suffix, left.suffix_length, right.prefix, right.prefix_length, 0);
+        literal_keep_longer(info, left.required, left.required_length);
+        literal_keep_longer(info, right.required, right.required_length);
+        literal_keep_longer(info, middle, middle_length);
+        literal_keep_longer(info, info->exact, info->exact_length);
+        return;
+    }
+    case NODE_ALTERNATE:
+    {
+        // Only useful when both sides are the same fixed string, like "(ab|ab)".
+        LiteralInfo left;
+        LiteralInfo right;
+        extract_literals(node->left, &left);
+        extract_literals(node->right, &right);
+        if (left.exact_length >= 0 && left.exact_length == right.exact_length &&
+            memcmp(left.exact, right.exact, (size_t)left.exact_length) == 0)
+        {
+            *info = left;
+        }
+        return;
+    }
+    case NODE_REPEAT:
+        if (node->min >= 1)
+        {
+            extract_literals(node->left, info);
+            if (node->min != 1 || node->max != 1)
+            {
+                info->exact_length = -1; // "(ab)+" is not the fixed string "ab".
+            }
+        }
+        return;
+    }
+}
+
+// Parses and compiles `pattern`. Returns 0, or 1 after printing an error message.
+int regex_compile(Regex *regex, const char *pattern, int ignore_case)
+{
+    memset(regex, 0, sizeof(*regex));
+    regex->ignore_case = ignore_case;
+    RegexParser parser = {0};
+    parser.pattern = (const unsigned char *)pattern;
+    parser.length = (long)strlen(pattern);
+    parser.ignore_case = ignore_case;
+    parser.nodes = malloc((size_t)(2 * parser.length + 2) * sizeof(RegexNode));
+    if (parser.nodes == NULL)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    RegexNode *root = parse_alternation(&parser);
+    if (root != NULL && parser.position < parser.length)
+    {
+        parser.error = "unmatched )";
+        root = NULL;
+    }
+    if (root == NULL)
+    {
+        fprintf(stderr, "Error in regular expression at position %ld: %s\n", parser.position, parser.error);
+        free(parser.nodes);
+        return 1;
+    }
+
+    int match = nfa_add(regex, NFA_MATCH, -1, -1, NULL);
+    regex->start = nfa_compile(regex, root, match);
+    if (regex->start < 0)
+    {
+        fprintf(stderr, "Error: the regular expression is too big.\n");
+        free(parser.nodes);
+        free(regex->states);
+        regex->states = NULL;
+        return 1;
+    }
+
+    LiteralInfo literals;
+    extract_literals(root, &literals);
+    regex->is_literal = !parser.has_anchors && literals.exact_length > 0;
+    memcpy(regex->required_text, literals.required, (size_t)literals.required_length);
+    regex->required_length = literals.required_length;
+    if (regex->required_length > 0)
+    {
+        if (ignore_case)
+        {
+            fold_case((char *)regex->required_text, regex->required_length);
+        }
+        searcher_init(&regex->required, (const char *)regex->required_text, regex->required_length, ignore_case);
+    }
+    free(parser.nodes);
+    return 0;
+}
+
+// Step 3: the LAZY DFA. A DFA state is a SET of NFA states, all "alive" at once.
+// Computing the next set for a byte is slow, so each answer is remembered in
+// `table`, and the next time the DFA state sees that byte it is one lookup.
+// Every worker thread has its own cache, so they never wait for each other.
+typedef struct
+{
+    const Regex *regex;  // The regex these states belong to
+    int *table;          // table[state * 256 + byte]: next state, DFA_UNKNOWN or DFA_MATCH
+    int *set_start;      // The NFA states of DFA state s are sets[set_start[s] .. set_start[s + 1] - 1]
+    int *sets;
+    long sets_used;
+    long sets_capacity;
+    int count;
+    int *hash;           // Open-addressing hash table: NFA set -> DFA state, -1 empty
+    int after_bol;       // The DFA state at the start of every line
+    int empty_match;     // The regex matches at the start of any line (like "^" or "x*")
+    unsigned *marks;     // marks[s] == generation: NFA state s is in the set being built
+    unsigned generation;
+    int *stack;          // Scratch space for nfa_add_closure()
+    int *scratch[3];     // Scratch NFA sets
+} DfaCache;
+
+_Thread_local DfaCache t_dfa_cache; // `_Thread_local`: every thread has its own copy
+
+void dfa_cache_free(void)
+{
+    DfaCache *cache = &t_dfa_cache;
+    free(cache->table);
+    free(cache->set_start);
+    free(cache->sets);
+    free(cache->hash);
+    free(cache->marks);
+    free(cache->stack);
+    for (int i = 0; i < 3; i++)
+    {
+        free(cache->scratch[i]);
+    }
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Starts building a new NFA set: forget which states the last one had.
+void new_generation(DfaCache *cache, int nfa_count)
+{
+    if (++cache->generation == 0) // Wrapped around: old marks could look current.
+    {
+        memset(cache->marks, 0, (size_t)nfa_count * sizeof(unsigned));
+        cache->generation = 1;
+    }
+}
+
+// Adds NFA state `state` and everything reachable from it through SPLITs to the
+// set `out`. Returns 1 if the MATCH state was reached.
+int nfa_add_closure(const Regex *regex, DfaCache *cache, int state, int *out, int *count)
+{
+    int matched = 0;
+    int stack_top = 0;
+    int *stack = cache->stack;
+    if (cache->marks[state] == cache->generation)
+    {
+        return 0;
+    }
+    cache->marks[state] = cache->generation; // Marking on push: each state is pushed once.
+    stack[stack_top++] = state;
+    while (stack_top > 0)
+    {
+        int s = stack[--stack_top];
+        const NfaState *nfa = &regex->states[s];
+        if (nfa->kind == NFA_SPLIT)
+        {
+            if (cache->marks[nfa->out1] != cache->generation)
+            {
+                cache->marks[nfa->out1] = cache->generation;
+                stack[stack_top++] = nfa->out1;
+            }
+            if (cache->marks[nfa->out] != cache->generation)
+            {
+                cache->marks[nfa->out] = cache->generation;
+                stack[stack_top++] = nfa->out;
+            }
+        }
+        else if (nfa->kind == NFA_MATCH)
+        {
+            matched = 1;
+        }
+        else
+        {
+            out[(*count)++] = s;
+        }
+    }
+    return matched;
+}
+
+// Feeds one symbol (a byte, SYMBOL_BOL or SYMBOL_EOL) to the NFA states in `from`,
+// and writes the states that follow into `out`. Unless the line ended, a new
+// match attempt also starts at the next position. Returns 1 if a match is complete.
+int nfa_step(const Regex *regex, DfaCache *cache, const int *from, int from_count, int symbol,
+             int *out, int *out_count)
+{
+    int matched = 0;
+    *out_count = 0;
+    new_generation(cache, regex->count);
+    for (int i = 0; i < from_count; i++)
+    {
+        const NfaState *nfa = &regex->states[from[i]];
+        int moves = symbol < 256 ? nfa->kind == NFA_SET && set_has(nfa->set, symbol)
+                                 : nfa->kind == (symbol == SYMBOL_BOL ? NFA_BOL : NFA_EOL);
+        if (moves)
+        {
+            matched |= nfa_add_closure(regex, cache, nfa->out, out, out_count);
+        }
+    }
+    if (symbol != SYMBOL_EOL)
+    {
+        matched |= nfa_add_closure(regex, cache, regex->start, out, out_count);
+    }
+    // `^` and `$` take up no text: at the start of a line, a `^` reached just now
+    // (as in "^^a") sees the same start of line. `out` grows as we go.
+    if (symbol >= 256)
+    {
+        for (int i = 0; i < *out_count; i++)
+        {
+            const NfaState *nfa = &regex->states[out[i]];
+            if (nfa->kind == (symbol == SYMBOL_BOL ? NFA_BOL : NFA_EOL))
+            {
+                matched |= nfa_add_closure(regex, cache, nfa->out, out, out_count);
+            }
+        }
+    }
+    return matched;
+}
+
+int compare_ints(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// Finds the DFA state for an NFA set, adding it if it is new. Returns its number,
+// or -1 when the cache is full.
+int dfa_state_for(DfaCache *cache, int *set, int count)
+{
+    qsort(set, (size_t)count, sizeof(int), compare_ints); // The same set, the same order
+    unsigned long hash = 2166136261UL;
+    for (int i = 0; i < count; i++)
+    {
+        hash = (hash ^ (unsigned long)set[i]) * 16777619UL;
+    }
+
+    unsigned long slot = hash % (2 * DFA_MAX_STATES);
+    while (cache->hash[slot] >= 0)
+    {
+        int s = cache->hash[slot];
+        int length = cache->set_start[s + 1] - cache->set_start[s];
+        if (length == count && memcmp(cache->sets + cache->set_start[s], set, (size_t)count * sizeof(int)) == 0)
+        {
+            return s;
+        }
+        slot = (slot + 1) % (2 * DFA_MAX_STATES);
+    }
+
+    if (cache->count == DFA_MAX_STATES)
+    {
+        return -1;
+    }
+    if (cache->sets_used + count > cache->sets_capacity)
+    {
+        long capacity = 2 * (cache->sets_used + count);
+        int *bigger = realloc(cache->sets, (size_t)capacity * sizeof(int));
+        if (bigger == NULL)
+        {
+            return -1;
+        }
+        cache->sets = bigger;
+        cache->sets_capacity = capacity;
+    }
+
+    int s = cache->count++;
+    memcpy(cache->sets + cache->sets_used, set, (size_t)count * sizeof(int));
+    cache->sets_used += count;
+    cache->set_start[s + 1] = (int)cache->sets_used;
+    memset(cache->table + (long)s * 256, 0xFF, 256 * sizeof(int)); // All DFA_UNKNOWN
+    cache->hash[slot] = s;
+    return s;
+}
+
+// Empties the cache and creates the start-of-line state. Returns 0, or 1 if
+// there is not enough memory.
+int dfa_cache_reset(const Regex *regex)
+{
+    DfaCache *cache = &t_dfa_cache;
+    if (cache->regex != regex)
+    {
+        dfa_cache_free();
+        cache->regex = regex;
+        cache->table = malloc((size_t)DFA_MAX_STATES * 256 * sizeof(int));
+        cache->set_start = malloc((DFA_MAX_STATES + 1) * sizeof(int));
+        cache->hash = malloc(2 * DFA_MAX_STATES * sizeof(int));
+        cache->marks = calloc((size_t)regex->count, sizeof(unsigned));
+        cache->stack = malloc((size_t)regex->count * sizeof(int));
+        int scratch_ok = 1;
+        for (int i = 0; i < 3; i++)
+        {
+            cache->scratch[i] = malloc((size_t)regex->count * sizeof(int));
+            scratch_ok = scratch_ok && cache->scratch[i] != NULL;
+        }
+        if (cache->table == NULL || cache->set_start == NULL || cache->hash == NULL || cache->marks == NULL ||
+            cache->stack == NULL || !scratch_ok)
+        {
+            dfa_cache_free();
+            return 1;
+        }
+    }
+    cache->count = 0;
+    cache->sets_used = 0;
+    cache->set_start[0] = 0;
+    for (int i = 0; i < 2 * DFA_MAX_STATES; i++)
+    {
+        cache->hash[i] = -1;
+    }
+
+    // At the start of a line: start the NFA, then feed it the start-of-line symbol.
+    int count = 0;
+    new_generation(cache, regex->count);
+    cache->empty_match = nfa_add_closure(regex, cache, regex->start, cache->scratch[0], &count);
+    cache->empty_match |= nfa_step(regex, cache, cache->scratch[0], count, SYMBOL_BOL, cache->scratch[1], &count);
+    cache->after_bol = dfa_state_for(cache, cache->scratch[1], count);
+    return cache->after_bol < 0;
+}
+
+// The slow path: works out where DFA state `state` goes on `byte`, and remembers
+// it. A '\n' ends the line: we feed the NFA the end-of-line symbol and, unless that
+// completes a match, continue with the start-of-line state. Returns the next
+// state, DFA_MATCH, or -1 if the cache is full.
+int dfa_compute(const Regex *regex, DfaCache *cache, int state, int byte)
+{
+    const int *from = cache->sets + cache->set_start[state];
+    int from_count = cache->set_start[state + 1] - cache->set_start[state];
+    int count;
+    int next;
+    if (byte == '\n')
+    {
+        int matched = nfa_step(regex, cache, from, from_count, SYMBOL_EOL, cache->scratch[0], &count);
+        next = matched ? DFA_MATCH : cache->after_bol;
+    }
+    else if (nfa_step(regex, cache, from, from_count, byte, cache->scratch[0], &count))
+    {
+        next = DFA_MATCH;
+    }
+    else
+    {
+        next = dfa_state_for(cache, cache->scratch[0], count);
+        if (next < 0)
+        {
+            return -1;
+        }
+    }
+    cache->table[(long)state * 256 + byte] = next;
+    return next;
+}
+
+// Does feeding the end-of-line symbol to the NFA set `set` complete a match?
+int nfa_matches_at_eol(const Regex *regex, DfaCache *cache, const int *set, int count)
+{
+    int out_count;
+    return nfa_step(regex, cache, set, count, SYMBOL_EOL, cache->scratch[2], &out_count);
+}
+
+// The NFA FALLBACK, for when the DFA cache fills up: the same steps, but nothing
+// is remembered. Slower, but still linear time. Starts from the NFA set of
+// DFA state `state`, at `position`.
+const char *nfa_search(const Regex *regex, DfaCache *cache, int state, const unsigned char *position,
+                       const unsigned char *text, const unsigned char *end)
+{
+    const unsigned char *line_start = memrchr(text, '\n', (size_t)(position - text));
+    line_start = line_start != NULL ? line_start + 1 : text;
+    int *current = cache->scratch[0];
+    int *next = cache->scratch[1];
+    int count = cache->set_start[state + 1] - cache->set_start[state];
+    memcpy(current, cache->sets + cache->set_start[state], (size_t)count * sizeof(int));
+
+    for (; position < end; position++)
+    {
+        int next_count;
+        if (*position == '\n')
+        {
+            if (nfa_step(regex, cache, current, count, SYMBOL_EOL, next, &next_count))
+            {
+                return (const char *)position;
+            }
+            // The start-of-line state is always in the cache.
+            next_count = cache->set_start[cache->after_bol + 1] - cache->set_start[cache->after_bol];
+            memcpy(next, cache->sets + cache->set_start[cache->after_bol], (size_t)next_count * sizeof(int));
+            line_start = position + 1;
+        }
+        else if (nfa_step(regex, cache, current, count, *position, next, &next_count))
+        {
+            return (const char *)position;
+        }
+        int *swap = current;
+        current = next;
+        next = swap;
+        count = next_count;
+    }
+    if (end > line_start && nfa_matches_at_eol(regex, cache, current, count))
+    {
+        return (const char *)end - 1;
+    }
+    return NULL;
+}
+
+// Runs the DFA over `text`, which starts at the start of a line. Returns a pointer
+// into the first matching line, or NULL.
+const char *dfa_search(const Regex *regex, const char *text, long text_length)
+{
+    DfaCache *cache = &t_dfa_cache;
+    if ((cache->regex != regex || cache->count == DFA_MAX_STATES) && dfa_cache_reset(regex) != 0)
+    {
+        fprintf(stderr, "Error: out of memory for the regex cache\n");
+        return NULL;
+    }
+    if (cache->empty_match)
+    {
+        return text_length > 0 ? text : NULL; // Every line matches.
+    }
+
+    const unsigned char *start = (const unsigned char *)text;
+    const unsigned char *position = start;
+    const unsigned char *end = position + text_length;
+    const int *table = cache->table;
+    int state = cache->after_bol;
+    while (position < end)
+    {
+        // The fast path: one table lookup per byte.
+        int next = table[(long)state * 256 + *position];
+        if (next >= 0)
+        {
+            state = next;
+            position++;
+            continue;
+        }
+        if (next == DFA_UNKNOWN)
+        {
+            next = dfa_compute(regex, cache, state, *position);
+            if (next == -1)
+            {
+                return nfa_search(regex, cache, state, position, start, end);
+            }
+            if (next != DFA_MATCH)
+            {
+                continue; // Now the table has it; take the fast path.
+            }
+        }
+        return (const char *)position;
+    }
+
+    // The last line may end without a '\n'. It still ends, though.
+    const int *set = cache->sets + cache->set_start[state];
+    int count = cache->set_start[state + 1] - cache->set_start[state];
+    if (end > start && end[-1] != '\n' && nfa_matches_at_eol(regex, cache, set, count))
+    {
+        return (const char *)end - 1;
+    }
+    return NULL;
+}
+
+// Returns a pointer into the first line of `text` that matches, or NULL. With a
+// required literal, the literal engine finds CANDIDATE lines first, and only those
+// go through the DFA: most of the text is skipped at literal-search speed.
+const char *regex_find(const Regex *regex, const char *text, long text_length)
+{
+    if (regex->is_literal)
+    {
+        return searcher_find(&regex->required, text, text_length);
+    }
+    if (regex->required_length < 2)
+    {
+        return dfa_search(regex, text, text_length);
+    }
+
+    const char *position = text;
+    const char *end = text + text_length;
+    while (position < end)
+    {
+        const char *candidate = searcher_find(&regex->required, position, end - position);
+        if (candidate == NULL)
+        {
+            return NULL;
+        }
+        const char *line_start = memrchr(position, '\n', (size_t)(candidate - position));
+        line_start = line_start != NULL ? line_start + 1 : position;
+        const char *line_end = memchr(candidate, '\n', (size_t)(end - candidate));
+        line_end = line_end != NULL ? line_end + 1 : end;
+
+        const char *match = dfa_search(regex, line_start, line_end - line_start);
+        if (match != NULL)
+        {
+            return match;
+        }
+        position = line_end;
+    }
+    return NULL;
+}
+
+// --- Approximate Matching `--fuzzy=k`: Bit-Parallel Myers ---
+#define FUZZY_MAX_WORDS 16   // Longest pattern: 16 words of 64 bits, 1024 bytes
+#define FUZZY_MIN_PIECE 3    // Shorter pigeonhole pieces would match almost everywhere
+
+// A pattern prepared for approximate search. Column j of the edit distance table
+// (one row per pattern byte) is kept as two bit vectors: bit i of `vp` is set
+// where the value goes UP by 1 from row i to row i + 1, and of `vn` where it goes
+// DOWN by 1. With 64 rows per word, one text byte costs a handful of word
+// operations per word, however many errors are allowed.
+typedef struct
+{
+    long length;                   // Bytes in the pattern (rows of the table)
+    int max_errors;                // k: the largest edit distance that still matches
+    int word_count;                // 64-bit words per column
+    unsigned long long last_bit;   // The bit of the last row, in the last word
+    unsigned long long *equal;     // equal[byte * word_count + w]: bits of the rows with `byte`
+    PatternSet pieces;             // The k + 1 exact pieces, or `count` 0 without a filter
+} FuzzyPattern;
+
+// Prepares `pattern` (already lowercase with `-i`) for search with up to
+// `max_errors` errors. Returns 0, or 1 after printing an error message.
+int fuzzy_compile(FuzzyPattern *fuzzy, const char *pattern, long length, int max_errors, int ignore_case)
+{
+    memset(fuzzy, 0, sizeof(*fuzzy));
+    if (length > 64L * FUZZY_MAX_WORDS)
+    {
+        fprintf(stderr, "Error: --fuzzy patterns can be at most %ld bytes long.\n", 64L * FUZZY_MAX_WORDS);
+        return 1;
+    }
+    if (max_errors >= length)
+    {
+        fprintf(stderr, "Error: with --fuzzy=%d the pattern must be longer than %d bytes.\n", max_errors,
+                max_errors);
+        return 1;
+    }
+    fuzzy->length = length;
+    fuzzy->max_errors = max_errors;
+    fuzzy->word_count = (int)((length + 63) / 64);
+    fuzzy->last_bit = 1ULL << ((length - 1) % 64);
+    fuzzy->equal = calloc(256 * (size_t)fuzzy->word_count, sizeof(unsigned long long));
+    if (fuzzy->equal == NULL)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    for (long i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)pattern[i];
+        fuzzy->equal[c * fuzzy->word_count + i / 64] |= 1ULL << (i % 64);
+        if (ignore_case && is_ascii_letter(c))
+        {
+            fuzzy->equal[(c ^ 0x20) * fuzzy->word_count + i / 64] |= 1ULL << (i % 64);
+        }
+    }
+
+    // THE PIGEONHOLE FILTER: cut the pattern into k + 1 pieces. k errors can touch
+    // at most k of them, so every match contains at least one piece EXACTLY.
+    long piece_count = max_errors + 1;
+    if (length / piece_count < FUZZY_MIN_PIECE)
+    {
+        return 0;
+    }
+    PatternSet *pieces = &fuzzy->pieces;
+    pieces->patterns = calloc((size_t)piece_count, sizeof(char *));
+    pieces->lengths = malloc((size_t)piece_count * sizeof(long));
+    int status = pieces->patterns == NULL || pieces->lengths == NULL;
+    for (long i = 0, start = 0; i < piece_count && status == 0; i++)
+    {
+        long end = length * (i + 1) / piece_count;
+        pieces->patterns[i] = malloc((size_t)(end - start) + 1);
+        if (pieces->patterns[i] == NULL)
+        {
+            status = 1;
+            break;
+        }
+        memcpy(pieces->patterns[i], pattern + start, (size_t)(end - start));
+        pieces->patterns[i][end - start] = '\0';
+        pieces->lengths[i] = end - start;
+        pieces->count++;
+        start = end;
+    }
+    if (status != 0 || pattern_set_build(pieces, ignore_case) != 0)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    return 0;
+}
+
+void fuzzy_free(FuzzyPattern *fuzzy)
+{
+    free(fuzzy->equal);
+    pattern_set_free(&fuzzy->pieces);
+}
+
+// Myers' algorithm for a pattern of up to 64 bytes: the whole column fits in one
+// word. `score` is the last row, the edit distance of the best match that ends at
+// the current byte. A '\n' starts the table over, so a match never spans lines.
+// Returns the last byte of the first match in [position, end), or NULL.
+const char *fuzzy_scan_word(const FuzzyPattern *fuzzy, const unsigned char *position, const unsigned char *end)
+{
+    const unsigned long long *equal = fuzzy->equal;
+    unsigned long long last_bit = fuzzy->last_bit;
+    unsigned long long vp = ~0ULL; // Before any text, row i holds i: every step goes up.
+    unsigned long long vn = 0;
+    long score = fuzzy->length;
+
+    for (; position < end; position++)
+    {
+        if (*position == '\n')
+        {
+            vp = ~0ULL;
+            vn = 0;
+            score = fuzzy->length;
+            continue;
+        }
+        // The horizontal steps (hp, hn) of the new column follow from the old
+        // vertical ones and the rows that match this byte. The addition carries
+        // a run of matches down the column in one instruction.
+        unsigned long long eq = equal[*position];
+        unsigned long long xv = eq | vn;
+        unsigned long long xh = (((eq & vp) + vp) ^ vp) | eq;
+        unsigned long long hp = vn | ~(xh | vp);
+        unsigned long long hn = vp & xh;
+        if (hp & last_bit)
+        {
+            score++;
+        }
+        else if (hn & last_bit)
+        {
+            score--;
+        }
+        // Row 0 is always 0 (a match may start anywhere), so nothing shifts in.
+        hp <<= 1;
+        hn <<= 1;
+        vp = hn | ~(xv | hp);
+        vn = hp & xv;
+        if (score <= fuzzy->max_errors)
+        {
+            return (const char *)position;
+        }
+    }
+    return NULL;
+}
+
+// The same for longer patterns: the column is cut into words, and each word passes
+// its last row's horizontal step (+1, 0 or -1) on to the next word as a carry.
+const char *fuzzy_scan_words(const FuzzyPattern *fuzzy, const unsigned char *position, const unsigned char *end)
+{
+    int word_count = fuzzy->word_count;
+    unsigned long long vp[FUZZY_MAX_WORDS];
+    unsigned long long vn[FUZZY_MAX_WORDS];
+    long score = fuzzy->length;
+    for (int w = 0; w < word_count; w++)
+    {
+        vp[w] = ~0ULL;
+        vn[w] = 0;
+    }
+
+    for (; position < end; position++)
+    {
+        if (*position == '\n')
+        {
+            for (int w = 0; w < word_count; w++)
+            {
+                vp[w] = ~0ULL;
+                vn[w] = 0;
+            }
+            score = fuzzy->length;
+            continue;
+        }
+        const unsigned long long *equal = fuzzy->equal + *position * word_count;
+        int carry = 0;
+        for (int w = 0; w < word_count; w++)
+        {
+            unsigned long long eq = equal[w];
+            unsigned long long xv = eq | vn[w];
+            if (carry < 0)
+            {
+                eq |= 1;
+            }
+            unsigned long long xh = (((eq & vp[w]) + vp[w]) ^ vp[w]) | eq;
+            unsigned long long hp = vn[w] | ~(xh | vp[w]);
+            unsigned long long hn = vp[w] & xh;
+            unsigned long long high = w == word_count - 1 ? fuzzy->last_bit : 1ULL << 63;
+            int step = (hp & high) ? 1 : (hn & high) ? -1 : 0;
+            hp <<= 1;
+            hn <<= 1;
+            if (carry < 0)
+            {
+                hn |= 1;
+            }
+            else if (carry > 0)
+            {
+                hp |= 1;
+            }
+            vp[w] = hn | ~(xv | hp);
+            vn[w] = hp & xv;
+            carry = step;
+        }
+        score += carry;
+        if (score <= fuzzy->max_errors)
+        {
+            return (const char *)position;
+        }
+    }
+    return NULL;
+}
+
+const char *fuzzy_scan(const FuzzyPattern *fuzzy, const char *text, const char *end)
+{
+    if (fuzzy->word_count == 1)
+    {
+        return fuzzy_scan_word(fuzzy, (const unsigned char *)text, (const unsigned char *)end);
+    }
+    return fuzzy_scan_words(fuzzy, (const unsigned char *)text, (const unsigned char *)end);
+}
+
+// Returns a pointer into the first line of `text` with a match of at most k
+// errors, or NULL. With the pigeonhole filter, Aho-Corasick finds the lines that
+// contain one of the pieces, and only those lines are checked with Myers.
+const char *fuzzy_find(const FuzzyPattern *fuzzy, const char *text, long text_length)
+{
+    const char *end = text + text_length;
+    if (fuzzy->pieces.count == 0)
+    {
+        return fuzzy_scan(fuzzy, text, end);
+    }
+
+    const char *position = text;
+    while (position < end)
+    {
+        long which;
+        const char *candidate = pattern_set_find(&fuzzy->pieces, position, end - position, &which);
+        if (candidate == NULL)
+        {
+            return NULL;
+        }
+        const char *line_start = memrchr(position, '\n', (size_t)(candidate - position));
+        line_start = line_start != NULL ? line_start + 1 : position;
+        const char *line_end = memchr(candidate, '\n', (size_t)(end - candidate));
+        line_end = line_end != NULL ? line_end + 1 : end;
+
+        const char *match = fuzzy_scan(fuzzy, line_start, line_end);
+        if (match != NULL)
+        {
+            return match;
+        }
+        position = line_end;
+    }
+    return NULL;
+}
+
+// --- The Matcher: One Pattern or Many ---
+typedef struct
+{
+    Searcher searcher; // One pattern, from the command line (or a one-line `-f` file)
+    PatternSet set;    // `-f`: the patterns. `set.count` is 0 without `-f`.
+    Regex regex;       // `-E`: the regular expression
+    int use_regex;
+    FuzzyPattern fuzzy; // `--fuzzy=k`: the pattern, with up to k errors
+    int use_fuzzy;
+    int ignore_case;   // `-i`
+    char *folded;      // `-i`: the lowercase copy of the pattern that `searcher` uses
+} Matcher;
+
+// Finds the first match like searcher_find(), and also says which `-f` pattern
+// it was (always 0 for a single pattern). For a regular expression or a fuzzy
+// match, the pointer is somewhere inside the matching line.
+const char *matcher_find(const Matcher *matcher, const char *text, long text_length, long *which)
+{
+    if (matcher->use_regex)
+    {
+        *which = 0;
+        return regex_find(&matcher->regex, text, text_length);
+    }
+    if (matcher->use_fuzzy)
+    {
+        *which = 0;
+        return fuzzy_find(&matcher->fuzzy, text, text_length);
+    }
+    if (matcher->set.count > 1)
+    {
+        return pattern_set_find(&matcher->set, text, text_length, which);
+    }
+    *which = 0;
+    return searcher_find(&matcher->searcher, text, text_length);
+}
+
+void matcher_free(Matcher *matcher)
+{
+    pattern_set_free(&matcher->set);
+    free(matcher->folded);
+    free(matcher->regex.states);
+    fuzzy_free(&matcher->fuzzy);
+    dfa_cache_free(); // The main thread's cache, if it searched a single file
+}
+
+// Prepares the single-pattern engine. With `-i`, it searches a lowercase copy.
+// Returns 0, or 1 after printing an error message.
+int matcher_set_pattern(Matcher *matcher, const char *pattern, long length)
+{
+    if (matcher->ignore_case)
+    {
+        matcher->folded = malloc((size_t)length + 1);
+        if (matcher->folded == NULL)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            return 1;
+        }
+        memcpy(matcher->folded, pattern, (size_t)length + 1);
+        fold_case(matcher->folded, length);
+        pattern = matcher->folded;
+    }
+    searcher_init(&matcher->searcher, pattern, length, matcher->ignore_case);
+    return 0;
+}
+
+// --- Writing the Output: One Big Buffer, Few System Calls ---
+#define OUTPUT_BUFFER_SIZE (256L * 1024)
+
+// Everything the program prints as its result goes through this buffer, and only
+// the main thread writes to it. Each `write()` is a system call, so we make as
+// few as we can: one per 256 KiB of output instead of one per few KiB.
+char g_output_buffer[OUTPUT_BUFFER_SIZE];
+long g_output_length;
+int g_output_failed; // Set once writing to standard output has failed
+
+// Writes `parts` to standard output with `writev()`: one system call for several
+// buffers, without first copying them together. A write may be cut short (a
+// full pipe, a signal), so we carry on from wherever it stopped.
+void write_parts(struct iovec *parts, int part_count)
+{
+    fflush(stdout); // Whatever printf() wrote before (the header) must come first.
+    while (part_count > 0 && !g_output_failed)
+    {
+        ssize_t written = writev(STDOUT_FILENO, parts, part_count);
+        if (written < 0)
+        {
+            if (errno != EINTR)
+            {
+                perror("Error writing the output");
+                g_output_failed = 1;
+            }
+            continue;
+        }
+        while (part_count > 0 && (size_t)written >= parts->iov_len)
+        {
+            written -= (ssize_t)parts->iov_len;
+            parts++;
+            part_count--;
+        }
+        if (part_count > 0)
+        {
+            parts->iov_base = (char *)parts->iov_base + written;
+            parts->iov_len -= (size_t)written;
+        }
+    }
+}
+
+// Adds bytes to the output. When they do not fit, the buffer and the new bytes
+// go out together in one `writev()`. That way a big block (a whole file's
+// matches) is never copied into the buffer at all.
+void output_bytes(const char *data, long length)
+{
+    if (length <= OUTPUT_BUFFER_SIZE - g_output_length)
+    {
+        memcpy(g_output_buffer + g_output_length, data, (size_t)length);
+        g_output_length += length;
+        return;
+    }
+    struct iovec parts[2] = {{g_output_buffer, (size_t)g_output_length}, {(void *)data, (size_t)length}};
+    write_parts(parts, 2);
+    g_output_length = 0;
+}
+
+// Writes out whatever is still buffered. Returns 0, or 1 if any write failed.
+int output_flush(void)
+{
+    struct iovec part = {g_output_buffer, (size_t)g_output_length};
+    write_parts(&part, 1);
+    g_output_length = 0;
+    return g_output_failed;
+}
+
+// --- Searching a Buffer of Whole Lines ---
+#define READ_BLOCK_SIZE (1024L * 1024) // Bytes read from the file at a time
+#define BINARY_CHECK_SIZE (64L * 1024) // The first read, checked for NUL bytes
+#define SEARCH_BINARY 2                // search_stream(): the file was skipped as binary
+
+// Where the matching lines of one file go.
+typedef struct
+{
+    FILE *stream;       // An in-memory stream (NULL until the first match)
+    char *memory;       // The bytes written to the in-memory stream
+    size_t memory_size;
+    const char *prefix; // Printed as "prefix:" before every line, or NULL
+    long count;         // Matching lines found so far
+    int direct;         // Write straight to the output buffer instead (main thread only)
+} Output;
+
+int g_count_only;      // Set by `-c`: count the matching lines instead of printing them
+int g_list_files;      // Set by `-l`: print only the names of the files that match
+long g_max_count = -1; // Set by `-m N`: stop each file after N matching lines (-1: no limit)
+
+// The growable buffer that search_stream() reads into. One per thread, reused
+// from file to file, so searching many small files does not allocate each time.
+typedef struct
+{
+    char *data;
+    long capacity;
+} ReadBuffer;
+
+// Returns the stream to write matches to, creating the in-memory stream on the
+// first match. `open_memstream()` gives us a FILE that writes into a buffer which
+// grows by itself: `fwrite()` and `fprintf()` just work on it.
+FILE *output_stream(Output *output)
+{
+    if (output->stream == NULL)
+    {
+        output->stream = open_memstream(&output->memory, &output->memory_size);
+    }
+    return output->stream;
+}
+
+// Appends bytes to a file's output. Returns 0, or 1 if they could not be buffered.
+int output_write(Output *output, const char *data, long length)
+{
+    if (output->direct)
+    {
+        output_bytes(data, length);
+        return 0;
+    }
+    FILE *stream = output_stream(output);
+    return stream == NULL || fwrite(data, 1, (size_t)length, stream) != (size_t)length;
+}
+
+// Has this file's output found all the lines that `-m` (or `-l`) asked for?
+int output_full(const Output *output)
+{
+    return g_max_count >= 0 && output->count >= g_max_count;
+}
+
+// Prints every line of `buffer[0..length-1]` that contains the pattern. The buffer
+// holds whole lines only (the last one may lack its '\n' at the end of the file).
+// With `-f`, each line starts with the pattern that matched, like "[pattern] ".
+// With `-c` or `-l`, the lines are only counted in `output->count`. With `-m`,
+// the search stops once the file has enough matching lines.
+// Returns 0, or 1 if the output could not be written.
+int search_buffer(const Matcher *matcher, const char *buffer, long length, Output *output)
+{
+    const char *position = buffer;
+    const char *end = buffer + length;
+
+    while (position < end && !output_full(output))
+    {
+        long which;
+        const char *match = matcher_find(matcher, position, end - position, &which);
+        if (match == NULL)
+        {
+            break;
+        }
+
+        // Walk forward to the end of the matching line, and back to its start.
+        const char *line_end = memchr(match, '\n', (size_t)(end - match));
+        line_end = line_end != NULL ? line_end + 1 : end;
+        output->count++;
+        if (g_count_only || g_list_files)
+        {
+            position = line_end;
+            continue;
+        }
+        const char *line_start = memrchr(buffer, '\n', (size_t)(match - buffer));
+        line_start = line_start != NULL ? line_start + 1 : buffer;
+
+        int failed = 0;
+        if (output->prefix != NULL)
+        {
+            failed |= output_write(output, output->prefix, (long)strlen(output->prefix));
+            failed |= output_write(output, ":", 1);
+        }
+        if (matcher->set.count > 0)
+        {
+            failed |= output_write(output, "[", 1);
+            failed |= output_write(output, matcher->set.patterns[which], matcher->set.lengths[which]);
+            failed |= output_write(output, "] ", 2);
+        }
+        failed |= output_write(output, line_start, line_end - line_start);
+        if (line_end[-1] != '\n')
+        {
+            failed |= output_write(output, "\n", 1); // The last line of the file had no '\n'.
+        }
+        if (failed)
+        {
+            return 1;
+        }
+        position = line_end; // The next match must be on a later line.
+    }
+    return 0;
+}
+
+// Reads `file` block by block and prints its matching lines. Returns 0 on success,
+// 1 after printing an error message, or SEARCH_BINARY if the file was skipped
+// because its first block contains a NUL byte.
+int search_stream(const Matcher *matcher, FILE *file, ReadBuffer *buffer, Output *output)
+{
+    // `malloc()` the buffer: megabytes are too big to put on the stack comfortably.
+    if (buffer->data == NULL)
+    {
+        buffer->capacity = 2 * READ_BLOCK_SIZE;
+        buffer->data = malloc((size_t)buffer->capacity);
+        if (buffer->data == NULL)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            return 1;
+        }
+    }
+
+    long kept = 0; // Bytes of an unfinished line carried over from the last block
+    int first_block = 1;
+    for (;;)
+    {
+        // Always read at least a whole block. When the unfinished line leaves less
+        // room than that, DOUBLE the buffer. Doubling keeps the total copying done
+        // by `realloc()` below twice the length of the longest line.
+        if (buffer->capacity - kept < READ_BLOCK_SIZE)
+        {
+            char *bigger = realloc(buffer->data, (size_t)(2 * buffer->capacity));
+            if (bigger == NULL)
+            {
+                fprintf(stderr, "Error: out of memory for a line of %ld bytes\n", kept);
+                return 1;
+            }
+            buffer->data = bigger;
+            buffer->capacity *= 2;
+        }
+
+        // Fill the rest of the buffer. `fread()` only returns fewer bytes than we
+        // asked for at the end of the file (or on a read error). The first read
+        // is small, so a binary file is rejected before we read much of it.
+        size_t wanted = (size_t)(first_block ? BINARY_CHECK_SIZE : buffer->capacity - kept);
+        size_t got = fread(buffer->data + kept, 1, wanted, file);
+        long filled = kept + (long)got;
+        int at_end = got < wanted;
+
+        // Text files never contain a NUL byte; binary files almost always have
+        // one near the start. Checking the first block is enough to skip them.
+        if (first_block && memchr(buffer->data, '\0', got) != NULL)
+        {
+            return SEARCH_BINARY;
+        }
+        first_block = 0;
+
+        // Only search up to the last '\n'. The kept bytes have none, so we only
+        // need to look through the bytes we just read.
+        long complete = filled;
+        if (!at_end)
+        {
+            const char *last_newline = memrchr(buffer->data + kept, '\n', got);
+            complete = last_newline != NULL ? last_newline - buffer->data + 1 : 0;
+        }
+
+        // Each line is searched exactly once, when it is complete.
+        if (search_buffer(matcher, buffer->data, complete, output) != 0)
+        {
+            fprintf(stderr, "Error: could not buffer the output\n");
+            return 1;
+        }
+
+        // `-m` or `-l`: the rest of the file does not matter any more.
+        if (output_full(output))
+        {
+            return 0;
+        }
+
+        // Move the unfinished line to the front for the next round.
+        kept = filled - complete;
+        if (complete > 0)
+        {
+            memmove(buffer->data, buffer->data + complete, (size_t)kept);
+        }
+
+        if (at_end)
+        {
+            if (ferror(file))
+            {
+                perror("Error reading file");
+                return 1;
+            }
+            return 0;
+        }
+    }
+}
+
+// --- Searching Many Files in Parallel ---
+#define MAX_WORKERS 64
+#define PRINT_BATCH 64 // Nodes finished between two wake-ups of the printing thread
+
+// One file or directory in the tree we search. Directories list their entries
+// in `children`, sorted by name, so that the output order is always the same.
+typedef struct SearchNode
+{
+    char *path;
+    int is_directory;
+    int finished;                 // File: searched. Directory: entries listed.
+    struct SearchNode **children; // Directory: its files and subdirectories
+    long child_count;
+    Output output;                // File: its matching lines, kept in memory
+} SearchNode;
+
+const Matcher *g_matcher; // The pattern(s), shared read-only by every worker
+int g_prefix_lines;         // Print "path:" before lines (more than one file)
+
+// Everything below is protected by `g_tree_lock`, including every node's
+// `finished` flag.
+pthread_mutex_t g_tree_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_work_ready = PTHREAD_COND_INITIALIZER;    // New work, or all done
+pthread_cond_t g_node_finished = PTHREAD_COND_INITIALIZER; // `g_awaited` finished
+SearchNode **g_work_stack; // Nodes that no worker has picked up yet
+long g_work_count;
+long g_work_capacity;
+long g_unfinished;         // Nodes pushed but not finished; 0 means all done
+long g_finished_count;     // Nodes finished so far
+SearchNode *g_awaited;     // The node the printing thread is waiting for
+long g_wake_printer_at;    // ...and how many nodes must be finished before waking it
+int g_search_status;       // Becomes 1 if any file could not be searched
+
+SearchNode *new_node(char *path, int is_directory)
+{
+    SearchNode *node = calloc(1, sizeof(SearchNode));
+    if (node == NULL)
+    {
+        free(path);
+        return NULL;
+    }
+    node->path = path;
+    node->is_directory = is_directory;
+    return node;
+}
+
+// Call with `g_tree_lock` held.
+void finish_node(SearchNode *node)
+{
+    node->finished = 1;
+    g_unfinished--;
+    g_finished_count++;
+
+    // Waking the printing thread for every file would cost a context switch per
+    // file. So once its node is done, we let it sleep until a batch more is.
+    if (g_awaited != NULL && g_awaited->finished &&
+        (g_finished_count >= g_wake_printer_at || g_unfinished == 0))
+    {
+        pthread_cond_signal(&g_node_finished);
+    }
+    if (g_unfinished == 0)
+    {
+        pthread_cond_broadcast(&g_work_ready); // Wake the idle workers so they exit.
+    }
+}
+
+// Call with `g_tree_lock` held. If the stack cannot grow, the node is finished
+// right away (with nothing found) so that nobody waits for it forever.
+void push_work(SearchNode *node)
+{
+    g_unfinished++;
+    if (g_work_count == g_work_capacity)
+    {
+        long capacity = g_work_capacity > 0 ? 2 * g_work_capacity : 1024;
+        SearchNode **bigger = realloc(g_work_stack, (size_t)capacity * sizeof(SearchNode *));
+        if (bigger == NULL)
+        {
+            fprintf(stderr, "Error: out of memory, skipping %s\n", node->path);
+            g_search_status = 1;
+            finish_node(node);
+            return;
+        }
+        g_work_stack = bigger;
+        g_work_capacity = capacity;
+    }
+    g_work_stack[g_work_count++] = node;
+    pthread_cond_signal(&g_work_ready);
+}
+
+int compare_nodes(const void *a, const void *b)
+{
+    return strcmp((*(SearchNode *const *)a)->path, (*(SearchNode *const *)b)->path);
+}
+
+// Builds "directory/name" in a new malloc'd string.
+char *join_path(const char *directory, const char *name)
+{
+    size_t length = strlen(directory);
+    int needs_slash = length > 0 && directory[length - 1] != '/';
+    char *path = malloc(length + (size_t)needs_slash + strlen(name) + 1);
+    if (path != NULL)
+    {
+        sprintf(path, needs_slash ? "%s/%s" : "%s%s", directory, name);
+    }
+    return path;
+}
+
+// Reads a directory's entries into `node->children`, sorted by name. Symbolic
+// links, devices and other special files are left out, like `grep -r` does.
+// Returns 0, or 1 after printing an error message.
+int list_directory(SearchNode *node)
+{
+    DIR *directory = opendir(node->path);
+    if (directory == NULL)
+    {
+        fprintf(stderr, "Error opening directory %s: %s\n", node->path, strerror(errno));
+        return 1;
+    }
+
+    long capacity = 0;
+    int status = 0;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char *path = join_path(node->path, entry->d_name);
+        if (path == NULL)
+        {
+            status = 1;
+            break;
+        }
+
+        // Most file systems tell us the entry's type for free in `d_type`. Only
+        // when one does not (DT_UNKNOWN) do we pay for an lstat() call.
+        int type = entry->d_type;
+        struct stat info;
+        if (type == DT_UNKNOWN && lstat(path, &info) == 0)
+        {
+            type = S_ISDIR(info.st_mode) ? DT_DIR : S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type != DT_DIR && type != DT_REG)
+        {
+            free(path);
+            continue;
+        }
+
+        if (node->child_count == capacity)
+        {
+            capacity = capacity > 0 ? 2 * capacity : 16;
+            SearchNode **bigger = realloc(node->children, (size_t)capacity * sizeof(SearchNode *));
+            if (bigger == NULL)
+            {
+                free(path);
+                status = 1;
+                break;
+            }
+            node->children = bigger;
+        }
+        SearchNode *child = new_node(path, type == DT_DIR);
+        if (child == NULL)
+        {
+            status = 1;
+            break;
+        }
+        node->children[node->child_count++] = child;
+    }
+    closedir(directory);
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Error: out of memory while listing %s\n", node->path);
+    }
+    if (node->child_count > 1)
+    {
+        qsort(node->children, (size_t)node->child_count, sizeof(SearchNode *), compare_nodes);
+    }
+    return status;
+}
+
+// Searches one file into its node's in-memory output. Returns 0, or 1 after
+// printing an error message. Binary files are skipped without a message.
+int search_file(SearchNode *node, ReadBuffer *buffer)
+{
+    FILE *file = fopen(node->path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error opening file %s: %s\n", node->path, strerror(errno));
+        return 1;
+    }
+
+    node->output.prefix = g_prefix_lines ? node->path : NULL;
+    int status = search_stream(g_matcher, file, buffer, &node->output);
+    fclose(file);
+
+    // `-l` prints the path of every file that matches. `-c` prints one
+    // "path:count" line for every text file, even for 0.
+    if ((g_list_files ? node->output.count > 0 : g_count_only) && status == 0)
+    {
+        FILE *stream = output_stream(&node->output);
+        if (stream == NULL)
+        {
+            fprintf(stderr, "Error: could not buffer the output\n");
+            return 1;
+        }
+        if (g_list_files)
+        {
+            fprintf(stream, "%s\n", node->path);
+        }
+        else
+        {
+            fprintf(stream, "%s:%ld\n", node->path, node->output.count);
+        }
+    }
+
+    // Closing the in-memory stream makes `memory` and `memory_size` final.
+    if (node->output.stream != NULL)
+    {
+        fclose(node->output.stream);
+        node->output.stream = NULL;
+    }
+    return status == SEARCH_BINARY ? 0 : status;
+}
+
+// A WORKER THREAD: takes the most recently pushed node, searches it (file) or
+// lists it (directory, pushing its entries as new work), and repeats until
+// every node is finished.
+void *search_worker(void *unused)
+{
+    (void)unused;
+    ReadBuffer buffer = {NULL, 0};
+
+    pthread_mutex_lock(&g_tree_lock);
+    for (;;)
+    {
+        while (g_work_count == 0 && g_unfinished > 0)
+        {
+            pthread_cond_wait(&g_work_ready, &g_tree_lock);
+        }
+        if (g_work_count == 0)
+        {
+            break; // Every node is finished.
+        }
+        SearchNode *node = g_work_stack[--g_work_count];
+        pthread_mutex_unlock(&g_tree_lock);
+
+        // The slow part (reading and searching) happens without the lock.
+        int status = node->is_directory ? list_directory(node) : search_file(node, &buffer);
+
+        pthread_mutex_lock(&g_tree_lock);
+        if (status != 0)
+        {
+            g_search_status = 1;
+        }
+        // Push the entries last-first, so the stack hands out the first one next.
+        // The workers then move through the tree roughly in the printing order.
+        for (long i = node->child_count - 1; i >= 0; i--)
+        {
+            push_work(node->children[i]);
+        }
+        finish_node(node);
+    }
+    pthread_mutex_unlock(&g_tree_lock);
+
+    free(buffer.data);
+    dfa_cache_free();
+    return NULL;
+}
+
+// Prints the tree in name order, waiting for each node as it gets there, and
+// frees it. The order never depends on which worker finished first.
+void print_tree(SearchNode *node)
+{
+    pthread_mutex_lock(&g_tree_lock);
+    g_awaited = node;
+    g_wake_printer_at = g_finished_count + PRINT_BATCH;
+    while (!node->finished)
+    {
+        pthread_cond_wait(&g_node_finished, &g_tree_lock);
+    }
+    g_awaited = NULL;
+    pthread_mutex_unlock(&g_tree_lock);
+
+    if (node->output.memory != NULL)
+    {
+        output_bytes(node->output.memory, (long)node->output.memory_size);
+        free(node->output.memory);
+    }
+    for (long i = 0; i < node->child_count; i++)
+    {
+        print_tree(node->children[i]);
+    }
+
+    free(node->children);
+    free(node->path);
+    free(node);
+}
+
+// One worker thread per CPU, but at least 1 and at most MAX_WORKERS.
+long count_workers(void)
+{
+    long worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (worker_count < 1)
+    {
+        worker_count = 1;
+    }
+    if (worker_count > MAX_WORKERS)
+    {
+        worker_count = MAX_WORKERS;
+    }
+    return worker_count;
+}
+
+// Searches every path on the command line (files, and directories recursively)
+// with a pool of worker threads. Returns 0, or 1 if anything failed.
+int search_paths(const Matcher *matcher, char **paths, int path_count)
+{
+    g_matcher = matcher;
+    g_prefix_lines = 1;
+
+    // The command-line paths are the children of a ROOT node that is already
+    // "listed". They keep the order the user gave them in.
+    SearchNode *root = new_node(NULL, 1);
+    if (root == NULL || (root->children = malloc((size_t)path_count * sizeof(SearchNode *))) == NULL)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        free(root);
+        return 1;
+    }
+    root->finished = 1;
+    for (int i = 0; i < path_count; i++)
+    {
+        struct stat info;
+        if (stat(paths[i], &info) != 0)
+        {
+            fprintf(stderr, "Error opening %s: %s\n", paths[i], strerror(errno));
+            g_search_status = 1;
+            continue;
+        }
+        char *path = malloc(strlen(paths[i]) + 1);
+        SearchNode *child = path != NULL ? new_node(strcpy(path, paths[i]), S_ISDIR(info.st_mode)) : NULL;
+        if (child == NULL)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            g_search_status = 1;
+            break;
+        }
+        root->children[root->child_count++] = child;
+    }
+
+    pthread_mutex_lock(&g_tree_lock);
+    for (long i = root->child_count - 1; i >= 0; i--)
+    {
+        push_work(root->children[i]);
+    }
+    pthread_mutex_unlock(&g_tree_lock);
+
+    // One worker per CPU. The main thread does the printing.
+    long worker_count = count_workers();
+    pthread_t workers[MAX_WORKERS];
+    for (long i = 0; i < worker_count; i++)
+    {
+        pthread_create(&workers[i], NULL, search_worker, NULL);
+    }
+
+    print_tree(root);
+
+    for (long i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    free(g_work_stack);
+    return output_flush() != 0 ? 1 : g_search_status;
+}
+
+// --- Splitting One Big File Across Threads ---
+#define CHUNK_SIZE (8L * 1024 * 1024)      // Bytes of the file in one piece of work
+#define PARALLEL_MIN_SIZE (4 * CHUNK_SIZE) // Smaller files are searched by one thread
+#define CHUNKS_AHEAD 4                     // Chunks per worker that may wait to be printed
+
+// One piece of a big file. It holds whole lines only, so no match can cross into
+// the next chunk, and it keeps its matching lines in memory until they are printed.
+typedef struct
+{
+    const char *start;
+    long length;
+    Output output;
+    int finished;
+} FileChunk;
+
+// Everything below is protected by `g_chunk_lock`, including every chunk's
+// `finished` flag.
+pthread_mutex_t g_chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_chunk_finished = PTHREAD_COND_INITIALIZER; // The next chunk to print is done
+pthread_cond_t g_chunk_printed = PTHREAD_COND_INITIALIZER;  // A chunk was printed and freed
+FileChunk *g_chunks;
+long g_chunk_count;
+long g_next_chunk;     // The chunk the next idle worker takes
+long g_printed_chunks; // Chunks printed so far: the printing thread waits for this one
+long g_chunk_window;   // Workers stay less than this many chunks ahead of the printer
+long g_total_count;    // `-c`: the matching lines of all finished chunks
+int g_chunk_status;    // Becomes 1 if any chunk's output could not be buffered
+
+// A WORKER THREAD for one big file: takes the next chunk in file order, searches
+// it into the chunk's own output buffer, and repeats until no chunk is left.
+void *chunk_worker(void *unused)
+{
+    (void)unused;
+
+    pthread_mutex_lock(&g_chunk_lock);
+    for (;;)
+    {
+        // Do not run too far ahead of the printing thread, or a file full of
+        // matches would pile up in memory. With `-c` nothing is printed.
+        while (!g_count_only && g_next_chunk < g_chunk_count &&
+               g_next_chunk >= g_printed_chunks + g_chunk_window)
+        {
+            pthread_cond_wait(&g_chunk_printed, &g_chunk_lock);
+        }
+        if (g_next_chunk == g_chunk_count)
+        {
+            break;
+        }
+        long index = g_next_chunk++;
+        FileChunk *chunk = &g_chunks[index];
+        pthread_mutex_unlock(&g_chunk_lock);
+
+        int status = search_buffer(g_matcher, chunk->start, chunk->length, &chunk->output);
+        if (chunk->output.stream != NULL)
+        {
+            fclose(chunk->output.stream);
+            chunk->output.stream = NULL;
+        }
+
+        pthread_mutex_lock(&g_chunk_lock);
+        if (status != 0)
+        {
+            g_chunk_status = 1;
+        }
+        g_total_count += chunk->output.count;
+        chunk->finished = 1;
+        if (index == g_printed_chunks)
+        {
+            pthread_cond_signal(&g_chunk_finished);
+        }
+    }
+    pthread_mutex_unlock(&g_chunk_lock);
+
+    dfa_cache_free();
+    return NULL;
+}
+
+// Searches one big file with all CPUs. The file is mapped into memory and cut
+// into chunks of about CHUNK_SIZE that end right after a '\n'. Workers search the
+// chunks in any order, and this thread prints their lines in file order. With
+// `-c` there is no order to keep: the workers just add up their counts.
+// Returns 0, 1 after printing an error message, or SEARCH_BINARY. Returns -1 if
+// the file cannot be mapped, and the caller should read it the normal way.
+int search_chunks(const Matcher *matcher, FILE *file, long long size)
+{
+    if ((unsigned long long)size > (size_t)-1)
+    {
+        return -1; // Too big for the address space (a 32-bit program).
+    }
+    char *data = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    // Text files never contain a NUL byte, just like in search_stream().
+    if (memchr(data, '\0', (size_t)(size < BINARY_CHECK_SIZE ? size : BINARY_CHECK_SIZE)) != NULL)
+    {
+        munmap(data, (size_t)size);
+        return SEARCH_BINARY;
+    }
+
+    g_chunk_count = (long)((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    g_chunks = calloc((size_t)g_chunk_count, sizeof(FileChunk));
+    if (g_chunks == NULL)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        munmap(data, (size_t)size);
+        return 1;
+    }
+
+    // Each chunk ends just after the first '\n' at or after its nominal end. A line
+    // longer than a chunk leaves the following chunks empty, which is fine. Every
+    // search for a '\n' starts where the last one stopped, so even a file without
+    // any '\n' is scanned only once here.
+    const char *end = data + size;
+    const char *start = data;
+    for (long i = 0; i < g_chunk_count; i++)
+    {
+        const char *stop = i == g_chunk_count - 1 ? end : data + (i + 1) * CHUNK_SIZE;
+        if (stop <= start)
+        {
+            stop = start;
+        }
+        else if (stop < end)
+        {
+            const char *newline = memchr(stop - 1, '\n', (size_t)(end - (stop - 1)));
+            stop = newline != NULL ? newline + 1 : end;
+        }
+        g_chunks[i].start = start;
+        g_chunks[i].length = stop - start;
+        start = stop;
+    }
+
+    g_matcher = matcher;
+    long worker_count = count_workers();
+    g_chunk_window = CHUNKS_AHEAD * worker_count;
+    pthread_t workers[MAX_WORKERS];
+    for (long i = 0; i < worker_count; i++)
+    {
+        pthread_create(&workers[i], NULL, chunk_worker, NULL);
+    }
+
+    // Print the chunks in file order, waiting where one is not done yet.
+    for (long i = 0; i < g_chunk_count && !g_count_only; i++)
+    {
+        pthread_mutex_lock(&g_chunk_lock);
+        while (!g_chunks[i].finished)
+        {
+            pthread_cond_wait(&g_chunk_finished, &g_chunk_lock);
+        }
+        pthread_mutex_unlock(&g_chunk_lock);
+
+        if (g_chunks[i].output.memory != NULL)
+        {
+            output_bytes(g_chunks[i].output.memory, (long)g_chunks[i].output.memory_size);
+            free(g_chunks[i].output.memory);
+        }
+
+        pthread_mutex_lock(&g_chunk_lock);
+        g_printed_chunks++;
+        pthread_cond_broadcast(&g_chunk_printed);
+        pthread_mutex_unlock(&g_chunk_lock);
+    }
+
+    for (long i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    if (output_flush() != 0)
+    {
+        g_chunk_status = 1;
+    }
+    if (g_count_only)
+    {
+        printf("%ld\n", g_total_count);
+    }
+    if (g_chunk_status != 0)
+    {
+        fprintf(stderr, "Error: could not buffer the output\n");
+    }
+    free(g_chunks);
+    munmap(data, (size_t)size);
+    return g_chunk_status;
+}
+
+// Prints the start of the header line: `Searching for "pattern" `.
+void print_search_header(const Matcher *matcher, const char *pattern)
+{
+    if (matcher->use_regex)
+    {
+        printf("Searching for regex /%s/ ", pattern);
+    }
+    else if (matcher->set.count > 0)
+    {
+        printf("Searching for %ld pattern%s from \"%s\" ", matcher->set.count, matcher->set.count == 1 ? "" : "s",
+               pattern);
+    }
+    else
+    {
+        printf("Searching for \"%s\" ", pattern);
+    }
+    if (matcher->use_fuzzy)
+    {
+        printf("(up to %d error%s) ", matcher->fuzzy.max_errors, matcher->fuzzy.max_errors == 1 ? "" : "s");
+    }
+    if (matcher->ignore_case)
+    {
+        printf("(ignoring case) ");
+    }
+}
+
+// --- A Trigram Index for Repeated Searches `--index` ---
+#define INDEX_FILE ".grep_index"      // Written to (and read from) the current directory
+#define INDEX_MAGIC "GREPIDX1"        // The first 8 bytes of every index file
+#define TRIGRAM_COUNT (1L << 24)      // Three bytes make 2^24 possible trigrams
+
+// One file in the index. If its size or modification time changes, the index
+// no longer knows what is in it.
+typedef struct
+{
+    char *path; // As the directory walk found it, e.g. "src/lib/util.c"
+    long long size;
+    long long modified_seconds;
+    long modified_nanoseconds;
+} IndexedFile;
+
+// The files that contain one trigram, as a compressed list of file numbers.
+typedef struct
+{
+    unsigned trigram;
+    unsigned char *bytes; // VARINT deltas, see posting_add()
+    long length;
+    long capacity; // 0 when `bytes` points into a loaded index file
+    long last_id;  // Building: the last file number added, plus 1 (0 = none yet)
+} PostingList;
+
+typedef struct
+{
+    char *root; // The directory that was indexed
+    IndexedFile *files;
+    long file_count;
+    long file_capacity;
+    PostingList *lists; // Sorted by trigram once the index is built or loaded
+    long list_count;
+    long list_capacity;
+    int *list_of;        // Building: trigram -> 1 + its place in `lists`, or 0
+    unsigned char *data; // Loaded: the whole index file
+} TrigramIndex;
+
+void index_free(TrigramIndex *index)
+{
+    for (long i = 0; i < index->file_count; i++)
+    {
+        free(index->files[i].path);
+    }
+    for (long i = 0; i < index->list_count; i++)
+    {
+        if (index->lists[i].capacity > 0)
+        {
+            free(index->lists[i].bytes);
+        }
+    }
+    free(index->root);
+    free(index->files);
+    free(index->lists);
+    free(index->list_of);
+    free(index->data);
+    memset(index, 0, sizeof(*index));
+}
+
+// Appends `value` as a VARINT: 7 bits per byte, lowest bits first, with the top
+// bit set on every byte but the last. Numbers below 128 take a single byte.
+int put_varint(unsigned char *out, unsigned long long value)
+{
+    int length = 0;
+    while (value >= 0x80)
+    {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+// Reads a varint at `*position`, and moves `*position` past it. Returns 0, or 1
+// if the data ends in the middle of it (a damaged file).
+int get_varint(const unsigned char **position, const unsigned char *end, unsigned long long *value)
+{
+    *value = 0;
+    for (int shift = 0; *position < end && shift < 64; shift += 7)
+    {
+        unsigned char byte = *(*position)++;
+        *value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (byte < 0x80)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void write_varint(FILE *file, unsigned long long value)
+{
+    unsigned char bytes[10];
+    fwrite(bytes, 1, (size_t)put_varint(bytes, value), file);
+}
+
+// Adds file number `id` to the list of `trigram`. Files are added in increasing
+// order, so we store the GAP to the previous number (DELTA ENCODING). A common
+// trigram appears in nearly every file, its gaps are all 1, and each file costs
+// it a single byte.
+int posting_add(TrigramIndex *index, unsigned trigram, long id)
+{
+    if (index->list_of[trigram] == 0)
+    {
+        if (index->list_count == index->list_capacity)
+        {
+            long capacity = index->list_capacity > 0 ? 2 * index->list_capacity : 4096;
+            PostingList *bigger = realloc(index->lists, (size_t)capacity * sizeof(PostingList));
+            if (bigger == NULL)
+            {
+                return 1;
+            }
+            index->lists = bigger;
+            index->list_capacity = capacity;
+        }
+        PostingList empty = {trigram, NULL, 0, 0, 0};
+        index->lists[index->list_count++] = empty;
+        index->list_of[trigram] = (int)index->list_count;
+    }
+
+    PostingList *list = &index->lists[index->list_of[trigram] - 1];
+    if (list->last_id == id + 1)
+    {
+        return 0; // Already there.
+    }
+    if (list->length + 10 > list->capacity)
+    {
+        long capacity = list->capacity > 0 ? 2 * list->capacity : 16;
+        unsigned char *bigger = realloc(list->bytes, (size_t)capacity);
+        if (bigger == NULL)
+        {
+            return 1;
+        }
+        list->bytes = bigger;
+        list->capacity = capacity;
+    }
+    list->length += put_varint(list->bytes + list->length, (unsigned long long)(id + 1 - list->last_id));
+    list->last_id = id + 1;
+    return 0;
+}
+
+// Decodes a posting list into `ids`, which has room for `max` numbers. Returns
+// how many there are.
+long posting_decode(const PostingList *list, long *ids, long max)
+{
+    const unsigned char *position = list->bytes;
+    const unsigned char *end = position + list->length;
+    long count = 0;
+    long previous = 0;
+    unsigned long long gap;
+    while (position < end && count < max && get_varint(&position, end, &gap) == 0)
+    {
+        previous += (long)gap;
+        ids[count++] = previous - 1;
+    }
+    return count;
+}
+
+int compare_lists(const void *a, const void *b)
+{
+    unsigned x = ((const PostingList *)a)->trigram;
+    unsigned y = ((const PostingList *)b)->trigram;
+    return x < y ? -1 : x > y;
+}
+
+const PostingList *find_list(const TrigramIndex *index, unsigned trigram)
+{
+    PostingList key = {trigram, NULL, 0, 0, 0};
+    return bsearch(&key, index->lists, (size_t)index->list_count, sizeof(PostingList), compare_lists);
+}
+
+// Loads INDEX_FILE. Returns 0, or 1 after printing an error message.
+int index_load(TrigramIndex *index)
+{
+    memset(index, 0, sizeof(*index));
+    FILE *file = fopen(INDEX_FILE, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error opening %s: %s. Build an index with --index build <directory>.\n", INDEX_FILE,
+                strerror(errno));
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fileno(file), &info) != 0 || (index->data = malloc((size_t)info.st_size + 1)) == NULL ||
+        fread(index->data, 1, (size_t)info.st_size, file) != (size_t)info.st_size)
+    {
+        fprintf(stderr, "Error reading %s\n", INDEX_FILE);
+        fclose(file);
+        index_free(index);
+        return 1;
+    }
+    fclose(file);
+
+    // Every count read from the file is checked against the bytes that are left,
+    // so a damaged file cannot make us allocate or read too much.
+    const unsigned char *position = index->data;
+    const unsigned char *end = position + info.st_size;
+    unsigned long long root_length, file_count, list_count;
+    int damaged = info.st_size < 8 || memcmp(position, INDEX_MAGIC, 8) != 0;
+    position += 8;
+    damaged = damaged || get_varint(&position, end, &root_length) || root_length > (unsigned long long)(end - position);
+    if (!damaged && (index->root = malloc(root_length + 1)) != NULL)
+    {
+        memcpy(index->root, position, root_length);
+        index->root[root_length] = '\0';
+        position += root_length;
+    }
+    damaged = damaged || index->root == NULL || get_varint(&position, end, &file_count) ||
+              file_count > (unsigned long long)(end - position);
+    if (!damaged)
+    {
+        index->files = calloc(file_count + 1, sizeof(IndexedFile));
+        damaged = index->files == NULL;
+    }
+    for (unsigned long long i = 0; !damaged && i < file_count; i++)
+    {
+        IndexedFile *entry = &index->files[i];
+        unsigned long long path_length, size = 0, seconds = 0, nanoseconds = 0;
+        damaged = get_varint(&position, end, &path_length) || path_length > (unsigned long long)(end - position) ||
+                  (entry->path = malloc(path_length + 1)) == NULL;
+        if (!damaged)
+        {
+            memcpy(entry->path, position, path_length);
+            entry->path[path_length] = '\0';
+            position += path_length;
+            index->file_count++;
+            damaged = get_varint(&position, end, &size) || get_varint(&position, end, &seconds) ||
+                      get_varint(&position, end, &nanoseconds);
+            entry->size = (long long)size;
+            entry->modified_seconds = (long long)seconds;
+            entry->modified_nanoseconds = (long)nanoseconds;
+        }
+    }
+    damaged = damaged || get_varint(&position, end, &list_count) || list_count > (unsigned long long)(end - position);
+    if (!damaged)
+    {
+        index->lists = calloc(list_count + 1, sizeof(PostingList));
+        damaged = index->lists == NULL;
+    }
+    for (unsigned long long i = 0; !damaged && i < list_count; i++)
+    {
+        unsigned long long trigram, length;
+        damaged = get_varint(&position, end, &trigram) || trigram >= TRIGRAM_COUNT ||
+                  get_varint(&position, end, &length) || length > (unsigned long long)(end - position) ||
+                  (i > 0 && trigram <= index->lists[i - 1].trigram);
+        if (!damaged)
+        {
+            PostingList list = {(unsigned)trigram, (unsigned char *)position, (long)length, 0, 0};
+            index->lists[index->list_count++] = list;
+            position += length;
+        }
+    }
+
+    if (damaged)
+    {
+        fprintf(stderr, "Error: %s is damaged or not an index. Build it again with --index build.\n", INDEX_FILE);
+        index_free(index);
+        return 1;
+    }
+    return 0;
+}
+
+// Writes the index to a temporary file, then renames it over INDEX_FILE. A crash
+// halfway through leaves the old index as it was. Returns 0, or 1 on error.
+int index_save(TrigramIndex *index)
+{
+    const char *temporary = INDEX_FILE ".tmp";
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error creating %s: %s\n", temporary, strerror(errno));
+        return 1;
+    }
+    fwrite(INDEX_MAGIC, 1, 8, file);
+    write_varint(file, strlen(index->root));
+    fputs(index->root, file);
+    write_varint(file, (unsigned long long)index->file_count);
+    for (long i = 0; i < index->file_count; i++)
+    {
+        const IndexedFile *entry = &index->files[i];
+        write_varint(file, strlen(entry->path));
+        fputs(entry->path, file);
+        write_varint(file, (unsigned long long)entry->size);
+        write_varint(file, (unsigned long long)entry->modified_seconds);
+        write_varint(file, (unsigned long long)entry->modified_nanoseconds);
+    }
+    qsort(index->lists, (size_t)index->list_count, sizeof(PostingList), compare_lists);
+    write_varint(file, (unsigned long long)index->list_count);
+    for (long i = 0; i < index->list_count; i++)
+    {
+        write_varint(file, index->lists[i].trigram);
+        write_varint(file, (unsigned long long)index->lists[i].length);
+        fwrite(index->lists[i].bytes, 1, (size_t)index->lists[i].length, file);
+    }
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed || rename(temporary, INDEX_FILE) != 0)
+    {
+        fprintf(stderr, "Error writing %s\n", INDEX_FILE);
+        remove(temporary);
+        return 1;
+    }
+    return 0;
+}
+
+// Adds a file (which takes over `path`) to the end of the index's file list.
+// Returns 0, or 1 after printing an error message.
+int index_add_file(TrigramIndex *index, char *path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0)
+    {
+        fprintf(stderr, "Error opening file %s: %s\n", path, strerror(errno));
+        free(path);
+        return 1;
+    }
+    if (index->file_count == index->file_capacity)
+    {
+        long capacity = index->file_capacity > 0 ? 2 * index->file_capacity : 1024;
+        IndexedFile *bigger = realloc(index->files, (size_t)capacity * sizeof(IndexedFile));
+        if (bigger == NULL)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            free(path);
+            return 1;
+        }
+        index->files = bigger;
+        index->file_capacity = capacity;
+    }
+    IndexedFile entry = {path, (long long)info.st_size, (long long)info.st_mtim.tv_sec, (long)info.st_mtim.tv_nsec};
+    index->files[index->file_count++] = entry;
+    return 0;
+}
+
+// Walks the tree below `node` in name order, like the search does, and adds
+// every regular file to the index. Frees the nodes on the way.
+int index_walk(TrigramIndex *index, SearchNode *node)
+{
+    int status = list_directory(node);
+    for (long i = 0; i < node->child_count; i++)
+    {
+        SearchNode *child = node->children[i];
+        const char *name = strrchr(child->path, '/');
+        name = name != NULL ? name + 1 : child->path;
+        if (child->is_directory)
+        {
+            status |= index_walk(index, child);
+            continue;
+        }
+        if (strcmp(name, INDEX_FILE) != 0 && strcmp(name, INDEX_FILE ".tmp") != 0)
+        {
+            status |= index_add_file(index, child->path);
+            child->path = NULL;
+        }
+        free(child->path);
+        free(child);
+    }
+    free(node->children);
+    free(node->path);
+    free(node);
+    return status;
+}
+
+// Reads file `id` and adds it to the list of every trigram in it. Trigrams are
+// stored case-folded, so one index serves searches with and without `-i`.
+// Trigrams that span a '\n' are left out: no match spans two lines. `seen` is
+// a bitmap of 2^24 bits that spots repeats cheaply; `found` lists what it holds.
+// Returns 0, or 1 after printing an error message.
+int index_read_file(TrigramIndex *index, long id, unsigned char *block, unsigned char *seen,
+                    unsigned **found, long *found_capacity)
+{
+    FILE *file = fopen(index->files[id].path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error opening file %s: %s\n", index->files[id].path, strerror(errno));
+        return 1;
+    }
+    long found_count = 0;
+    unsigned trigram = 0;
+    int line_bytes = 0; // Bytes since the last '\n', up to 3
+    int status = 0;
+    int first = 1;
+    size_t length;
+    while (status == 0 && (length = fread(block, 1, READ_BLOCK_SIZE, file)) > 0)
+    {
+        // Binary files are never searched, so they get no trigrams.
+        if (first && memchr(block, '\0', length < BINARY_CHECK_SIZE ? length : BINARY_CHECK_SIZE) != NULL)
+        {
+            break;
+        }
+        first = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            unsigned char c = block[i];
+            if (c == '\n')
+            {
+                line_bytes = 0;
+                continue;
+            }
+            trigram = ((trigram << 8) | fold_byte(c)) & (TRIGRAM_COUNT - 1);
+            if (line_bytes < 3)
+            {
+                line_bytes++;
+            }
+            if (line_bytes == 3 && !(seen[trigram >> 3] & (1 << (trigram & 7))))
+            {
+                seen[trigram >> 3] |= (unsigned char)(1 << (trigram & 7));
+                if (found_count == *found_capacity)
+                {
+                    long capacity = *found_capacity > 0 ? 2 * *found_capacity : 65536;
+                    unsigned *bigger = realloc(*found, (size_t)capacity * sizeof(unsigned));
+                    if (bigger == NULL)
+                    {
+                        status = 1;
+                        break;
+                    }
+                    *found = bigger;
+                    *found_capacity = capacity;
+                }
+                (*found)[found_count++] = trigram;
+            }
+        }
+    }
+    fclose(file);
+
+    // Add the file to each list, and clear the bitmap for the next file.
+    for (long i = 0; i < found_count; i++)
+    {
+        unsigned t = (*found)[i];
+        seen[t >> 3] = 0;
+        if (status == 0 && posting_add(index, t, id) != 0)
+        {
+            status = 1;
+        }
+    }
+    if (status != 0)
+    {
+        fprintf(stderr, "Error: out of memory while indexing %s\n", index->files[id].path);
+    }
+    return status;
+}
+
+int compare_files_by_path(const void *a, const void *b)
+{
+    return strcmp((*(IndexedFile *const *)a)->path, (*(IndexedFile *const *)b)->path);
+}
+
+// `--index build DIR`: indexes every file below `root`. If INDEX_FILE already
+// holds an index of the same directory, files whose size and modification time
+// have not changed are not read again: their trigrams are copied from the old
+// index (an INCREMENTAL update). Returns 0, or 1 if anything failed.
+int index_build(const char *root)
+{
+    struct stat info;
+    if (stat(root, &info) != 0 || !S_ISDIR(info.st_mode))
+    {
+        fprintf(stderr, "Error: %s is not a directory\n", root);
+        return 1;
+    }
+
+    // The old index, if there is one for this directory.
+    TrigramIndex old = {0};
+    if (access(INDEX_FILE, F_OK) == 0 && index_load(&old) == 0 && strcmp(old.root, root) != 0)
+    {
+        printf("%s indexes \"%s\"; replacing it with a new index.\n", INDEX_FILE, old.root);
+        index_free(&old);
+    }
+
+    // Walk the tree for the current list of files.
+    TrigramIndex walked = {0};
+    char *root_path = malloc(strlen(root) + 1);
+    SearchNode *top = root_path != NULL ? new_node(strcpy(root_path, root), 1) : NULL;
+    int status = top == NULL ? 1 : index_walk(&walked, top);
+
+    // Which files are unchanged? Look each one up in the old index by path.
+    long *old_to_new = malloc((size_t)(old.file_count + 1) * sizeof(long));
+    IndexedFile **by_path = malloc((size_t)(old.file_count + 1) * sizeof(IndexedFile *));
+    unsigned char *reused = calloc((size_t)walked.file_count + 1, 1);
+    TrigramIndex index = {0};
+    index.root = malloc(strlen(root) + 1);
+    index.files = malloc((size_t)(walked.file_count + 1) * sizeof(IndexedFile));
+    index.list_of = calloc((size_t)TRIGRAM_COUNT, sizeof(int));
+    unsigned char *seen = calloc((size_t)TRIGRAM_COUNT / 8, 1);
+    unsigned char *block = malloc(READ_BLOCK_SIZE);
+    long *ids = malloc((size_t)(old.file_count + 1) * sizeof(long));
+    if (old_to_new == NULL || by_path == NULL || reused == NULL || index.root == NULL || index.files == NULL ||
+        index.list_of == NULL || seen == NULL || block == NULL || ids == NULL)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        free(old_to_new);
+        free(by_path);
+        free(reused);
+        free(seen);
+        free(block);
+        free(ids);
+        index_free(&index);
+        index_free(&walked);
+        index_free(&old);
+        return 1;
+    }
+    strcpy(index.root, root);
+    for (long i = 0; i < old.file_count; i++)
+    {
+        old_to_new[i] = -1;
+        by_path[i] = &old.files[i];
+    }
+    qsort(by_path, (size_t)old.file_count, sizeof(IndexedFile *), compare_files_by_path);
+    for (long i = 0; i < walked.file_count; i++)
+    {
+        IndexedFile *key = &walked.files[i];
+        IndexedFile **match = bsearch(&key, by_path, (size_t)old.file_count, sizeof(IndexedFile *),
+                                      compare_files_by_path);
+        if (match != NULL && (*match)->size == key->size && (*match)->modified_seconds == key->modified_seconds &&
+            (*match)->modified_nanoseconds == key->modified_nanoseconds)
+        {
+            old_to_new[*match - old.files] = 0; // Unchanged. Its new number comes below.
+            reused[i] = 1;
+        }
+    }
+
+    // Number the unchanged files first, in their old order, and then the new or
+    // changed ones. Copying the old lists then keeps every list in increasing order.
+    for (long i = 0; i < old.file_count; i++)
+    {
+        if (old_to_new[i] == 0)
+        {
+            old_to_new[i] = index.file_count;
+            index.files[index.file_count++] = old.files[i];
+            old.files[i].path = NULL; // Now owned by the new index
+        }
+    }
+    long reused_count = index.file_count;
+    for (long i = 0; i < old.list_count && status == 0; i++)
+    {
+        long count = posting_decode(&old.lists[i], ids, old.file_count);
+        for (long j = 0; j < count && status == 0; j++)
+        {
+            if (ids[j] >= 0 && ids[j] < old.file_count && old_to_new[ids[j]] >= 0)
+            {
+                status = posting_add(&index, old.lists[i].trigram, old_to_new[ids[j]]);
+            }
+        }
+    }
+    unsigned *found = NULL;
+    long found_capacity = 0;
+    long long text_bytes = 0;
+    for (long i = 0; i < walked.file_count; i++)
+    {
+        if (!reused[i])
+        {
+            index.files[index.file_count] = walked.files[i];
+            walked.files[i].path = NULL;
+            status |= index_read_file(&index, index.file_count++, block, seen, &found, &found_capacity);
+        }
+        text_bytes += walked.files[i].size;
+    }
+
+    long long posting_bytes = 0;
+    for (long i = 0; i < index.list_count; i++)
+    {
+        posting_bytes += index.lists[i].length;
+    }
+    status |= index_save(&index);
+    if (status == 0 && stat(INDEX_FILE, &info) == 0)
+    {
+        printf("Indexed %ld files in \"%s\": %ld read, %ld unchanged since the last index.\n", index.file_count,
+               root, index.file_count - reused_count, reused_count);
+        printf("%ld trigrams, %lld bytes of posting lists. %s is %lld bytes, %.1f%% of the %lld bytes indexed.\n",
+               index.list_count, posting_bytes, INDEX_FILE, (long long)info.st_size,
+               text_bytes > 0 ? 100.0 * (double)info.st_size / (double)text_bytes : 0.0, text_bytes);
+    }
+
+    free(found);
+    free(old_to_new);
+    free(by_path);
+    free(reused);
+    free(seen);
+    free(block);
+    free(ids);
+    index_free(&index);
+    index_free(&walked);
+    index_free(&old);
+    return status;
+}
+
+// Marks in `candidates` every file that contains all the trigrams of `text`: the
+// only files where `text` can be. Each list is sorted, so INTERSECTING two lists
+// is one merge-like pass. We start with the shortest list, so the set of files
+// we carry along is as small as possible from the beginning. A text shorter than
+// 3 bytes has no trigrams, and then every file is a candidate.
+void index_mark_candidates(const TrigramIndex *index, const unsigned char *text, long length,
+                           unsigned char *candidates, long *ids, long *other)
+{
+    if (length < 3)
+    {
+        memset(candidates, 1, (size_t)index->file_count);
+        return;
+    }
+    const PostingList *shortest = NULL;
+    for (long i = 0; i + 2 < length; i++)
+    {
+        unsigned trigram = (unsigned)fold_byte(text[i]) << 16 | (unsigned)fold_byte(text[i + 1]) << 8 |
+                           fold_byte(text[i + 2]);
+        const PostingList *list = find_list(index, trigram);
+        if (list == NULL)
+        {
+            return; // No file has this trigram.
+        }
+        if (shortest == NULL || list->length < shortest->length)
+        {
+            shortest = list;
+        }
+    }
+
+    long count = posting_decode(shortest, ids, index->file_count);
+    for (long i = 0; i + 2 < length && count > 0; i++)
+    {
+        unsigned trigram = (unsigned)fold_byte(text[i]) << 16 | (unsigned)fold_byte(text[i + 1]) << 8 |
+                           fold_byte(text[i + 2]);
+        const PostingList *list = find_list(index, trigram);
+        if (list == shortest)
+        {
+            continue;
+        }
+        long other_count = posting_decode(list, other, index->file_count);
+        long kept = 0;
+        for (long a = 0, b = 0; a < count && b < other_count;)
+        {
+            if (ids[a] < other[b])
+            {
+                a++;
+            }
+            else if (ids[a] > other[b])
+            {
+                b++;
+            }
+            else
+            {
+                ids[kept++] = ids[a++];
+                b++;
+            }
+        }
+        count = kept;
+    }
+    for (long i = 0; i < count; i++)
+    {
+        if (ids[i] >= 0 && ids[i] < index->file_count)
+        {
+            candidates[ids[i]] = 1;
+        }
+    }
+}
+
+// Sorts paths in the order a directory search prints them: "a/z" before "a-b/c",
+// because the directory "a" comes before "a-b". So '/' sorts before any byte.
+int compare_tree_paths(const void *a, const void *b)
+{
+    const unsigned char *x = *(const unsigned char *const *)a;
+    const unsigned char *y = *(const unsigned char *const *)b;
+    while (*x != '\0' && *x == *y)
+    {
+        x++;
+        y++;
+    }
+    if (*x == *y)
+    {
+        return 0;
+    }
+    return *x == '/' ? -1 : *y == '/' ? 1 : *x - *y;
+}
+
+// `--indexed PATTERN`: asks the index which files can match, and searches only
+// those. Files that changed since the index was built are always searched, and
+// so are files below the index's root that it does not list yet.
+// Returns 0, or 1 if anything failed.
+int index_search(const Matcher *matcher, const char *pattern)
+{
+    TrigramIndex index;
+    if (index_load(&index) != 0)
+    {
+        return 1;
+    }
+
+    // The files that are there now. Any that the index does not list were
+    // created after it was built: nothing is known about them, so they are
+    // searched like changed files.
+    TrigramIndex walked = {0};
+    char *root_path = malloc(strlen(index.root) + 1);
+    SearchNode *top = root_path != NULL ? new_node(strcpy(root_path, index.root), 1) : NULL;
+    int status = top == NULL ? 1 : index_walk(&walked, top);
+
+    unsigned char *candidates = calloc((size_t)index.file_count + 1, 1);
+    long *ids = malloc((size_t)(index.file_count + 1) * sizeof(long));
+    long *other = malloc((size_t)(index.file_count + 1) * sizeof(long));
+    char **paths = malloc((size_t)(index.file_count + walked.file_count + 1) * sizeof(char *));
+    IndexedFile **by_path = malloc((size_t)(index.file_count + 1) * sizeof(IndexedFile *));
+    if (candidates == NULL || ids == NULL || other == NULL || paths == NULL || by_path == NULL)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        free(candidates);
+        free(ids);
+        free(other);
+        free(paths);
+        free(by_path);
+        index_free(&walked);
+        index_free(&index);
+        return 1;
+    }
+
+    // A match must contain the literal text of the pattern: for `-f`, of one of
+    // the patterns; for `-E`, the regex's required literal; for `--fuzzy`, one of
+    // the pigeonhole pieces (without them, any file can match).
+    if (matcher->use_fuzzy)
+    {
+        for (long i = 0; i < matcher->fuzzy.pieces.count; i++)
+        {
+            index_mark_candidates(&index, (const unsigned char *)matcher->fuzzy.pieces.patterns[i],
+                                  matcher->fuzzy.pieces.lengths[i], candidates, ids, other);
+        }
+        if (matcher->fuzzy.pieces.count == 0)
+        {
+            memset(candidates, 1, (size_t)index.file_count);
+        }
+    }
+    else if (matcher->use_regex)
+    {
+        index_mark_candidates(&index, matcher->regex.required_text, matcher->regex.required_length, candidates,
+                              ids, other);
+    }
+    else if (matcher->set.count > 0)
+    {
+        for (long i = 0; i < matcher->set.count; i++)
+        {
+            index_mark_candidates(&index, (const unsigned char *)matcher->set.patterns[i], matcher->set.lengths[i],
+                                  candidates, ids, other);
+        }
+    }
+    else
+    {
+        index_mark_candidates(&index, matcher->searcher.pattern, matcher->searcher.length, candidates, ids, other);
+    }
+
+    int path_count = 0;
+    long changed = 0;
+    for (long i = 0; i < index.file_count; i++)
+    {
+        struct stat info;
+        const IndexedFile *entry = &index.files[i];
+        if (stat(entry->path, &info) != 0)
+        {
+            continue; // Deleted since the index was built.
+        }
+        if (info.st_size != entry->size || info.st_mtim.tv_sec != entry->modified_seconds ||
+            info.st_mtim.tv_nsec != entry->modified_nanoseconds)
+        {
+            changed++;
+            candidates[i] = 1; // The index does not know what is in it now.
+        }
+        if (candidates[i])
+        {
+            paths[path_count++] = entry->path;
+        }
+    }
+    for (long i = 0; i < index.file_count; i++)
+    {
+        by_path[i] = &index.files[i];
+    }
+    qsort(by_path, (size_t)index.file_count, sizeof(IndexedFile *), compare_files_by_path);
+    long added = 0;
+    for (long i = 0; i < walked.file_count; i++)
+    {
+        IndexedFile *key = &walked.files[i];
+        if (bsearch(&key, by_path, (size_t)index.file_count, sizeof(IndexedFile *), compare_files_by_path) == NULL)
+        {
+            added++;
+            paths[path_count++] = key->path;
+        }
+    }
+    qsort(paths, (size_t)path_count, sizeof(char *), compare_tree_paths);
+
+    print_search_header(matcher, pattern);
+    printf("in the index of \"%s\" (%d of %ld files can match):\n\n", index.root, path_count,
+           index.file_count + added);
+    fflush(stdout);
+    status |= path_count > 0 ? search_paths(matcher, paths, path_count) : 0;
+    if (changed > 0 || added > 0)
+    {
+        fflush(stdout);
+        fprintf(stderr, "Note: %ld file(s) changed and %ld new since the index was built. Update it with "
+                        "--index build %s\n",
+                changed, added, index.root);
+    }
+
+    free(candidates);
+    free(ids);
+    free(other);
+    free(paths);
+    free(by_path);
+    index_free(&walked);
+    index_free(&index);
+    return status;
+}
+
+// --- The Benchmark `--bench` ---
+#define BENCH_TEXT_SIZE (32L * 1024 * 1024)
+#define BENCH_ROUNDS 3
+
+// The benchmark calls both searches through VOLATILE function pointers. The
+// compiler must then really make every call. Otherwise it may notice that
+// repeating strstr() with the same arguments gives the same answer, and skip it.
+const char *(*volatile g_bench_find)(const Searcher *, const char *, long) = searcher_find;
+char *(*volatile g_bench_strstr)(const char *, const char *) = strstr;
+
+double seconds_since(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Searches a generated text for patterns of many lengths that never match, so
+// both searches have to look at the whole text. Prints GB/s for each.
+int run_benchmark(void)
+{
+    static const long lengths[] = {1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 64, 128, 256};
+    char *text = malloc(BENCH_TEXT_SIZE + 1);
+    if (!text)
+    {
+        fprintf(stderr, "Could not allocate the benchmark text\n");
+        return 1;
+    }
+
+    // Lowercase "words" and spaces from a fixed-seed generator, so every run
+    // searches exactly the same text.
+    unsigned int state = 12345;
+    for (long i = 0; i < BENCH_TEXT_SIZE; i++)
+    {
+        state = state * 1103515245u + 12345u;
+        unsigned int r = (state >> 16) % 32;
+        text[i] = r < 26 ? (char)('a' + r) : (r == 26 ? '\n' : ' ');
+    }
+    text[BENCH_TEXT_SIZE] = '\0';
+
+    printf("Searching %ld MiB of text, best of %d runs.\n\n", BENCH_TEXT_SIZE >> 20, BENCH_ROUNDS);
+    printf("%8s  %-9s %10s %10s  %-9s %10s  %-9s %10s %12s\n", "length", "engine", "ours GB/s", "-i GB/s",
+           "no SIMD", "GB/s", "our C", "GB/s", "strstr GB/s");
+    for (size_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]); n++)
+    {
+        // A piece of the text with its last byte changed to one the text never
+        // contains: it nearly matches in places, but never fully.
+        char pattern[257];
+        long length = lengths[n];
+        memcpy(pattern, text + 1000, (size_t)length);
+        pattern[length - 1] = '#';
+        pattern[length] = '\0';
+
+        // "No SIMD" is what a CPU without AVX2 runs. "Our C" is Two-Way or
+        // Horspool, which such a CPU only runs for `-i`.
+        Searcher searcher, folding_searcher, scalar_searcher, portable_searcher;
+        int simd_setting = g_use_simd;
+        searcher_init(&searcher, pattern, length, 0);
+        searcher_init(&folding_searcher, pattern, length, 1); // `-i`
+        g_use_simd = 0;
+        searcher_init(&scalar_searcher, pattern, length, 0);
+        g_use_memmem = 0;
+        searcher_init(&portable_searcher, pattern, length, 0);
+        g_use_memmem = 1;
+        g_use_simd = simd_setting;
+
+        double best_ours = 1e9, best_folding = 1e9, best_scalar = 1e9, best_portable = 1e9, best_strstr = 1e9;
+        for (int round = 0; round < BENCH_ROUNDS; round++)
+        {
+            clock_t start = clock();
+            if (g_bench_find(&searcher, text, BENCH_TEXT_SIZE) != NULL)
+            {
+                printf("unexpected match\n");
+            }
+            double ours = seconds_since(start);
+
+            start = clock();
+            if (g_bench_find(&folding_searcher, text, BENCH_TEXT_SIZE) != NULL)
+            {
+                printf("unexpected match\n");
+            }
+            double folding = seconds_since(start);
+
+            start = clock();
+            if (g_bench_find(&scalar_searcher, text, BENCH_TEXT_SIZE) != NULL)
+            {
+                printf("unexpected match\n");
+            }
+            double scalar = seconds_since(start);
+
+            start = clock();
+            if (g_bench_find(&portable_searcher, text, BENCH_TEXT_SIZE) != NULL)
+            {
+                printf("unexpected match\n");
+            }
+            double portable = seconds_since(start);
+
+            start = clock();
+            if (g_bench_strstr(text, pattern) != NULL)
+            {
+                printf("unexpected match\n");
+            }
+            double theirs = seconds_since(start);
+
+            best_ours = ours < best_ours ? ours : best_ours;
+            best_folding = folding < best_folding ? folding : best_folding;
+            best_scalar = scalar < best_scalar ? scalar : best_scalar;
+            best_portable = portable < best_portable ? portable : best_portable;
+            best_strstr = theirs < best_strstr ? theirs : best_strstr;
+        }
+        printf("%8ld  %-9s %10.2f %10.2f  %-9s %10.2f  %-9s %10.2f %12.2f\n", length,
+               algorithm_name(searcher.algorithm), BENCH_TEXT_SIZE / 1e9 / (best_ours > 0 ? best_ours : 1e-9),
+               BENCH_TEXT_SIZE / 1e9 / (best_folding > 0 ? best_folding : 1e-9),
+               algorithm_name(scalar_searcher.algorithm),
+               BENCH_TEXT_SIZE / 1e9 / (best_scalar > 0 ? best_scalar : 1e-9),
+               algorithm_name(portable_searcher.algorithm),
+               BENCH_TEXT_SIZE / 1e9 / (best_portable > 0 ? best_portable : 1e-9),
+               BENCH_TEXT_SIZE / 1e9 / (best_strstr > 0 ? best_strstr : 1e-9));
+    }
+
+    free(text);
+    return 0;
+}
 
 // The main function signature for programs that accept command-line arguments.
 int main(int argc, char *argv[])
 {
     // --- Step 1: Validate Command-Line Arguments ---
 
-    // `argc` is the count of arguments. We expect exactly 3:
+    // `argc` is the count of arguments. We expect at least 3:
     // argv[0]: The program name (e.g., ./27_build_your_own_grep)
-    // argv[1]: The search pattern (e.g., "main")
-    // argv[2]: The filename (e.g., "27_build_your_own_grep.c")
-    if (argc != 3)
+    // argv[1]: The search pattern (e.g., "main"), or one of the options below
+    // argv[2...]: The files or directories to search (e.g., "27_build_your_own_grep.c")
+    // Options: `-f <file>` reads many patterns from a file, `-E <regex>` searches
+    // for a regular expression, `-i` ignores case, `-c` only counts the matching
+    // lines, `-l` only names the files that match, `-m N` stops each file after N
+    // matching lines, `--fuzzy=k` allows up to k typos, `--indexed` searches the files of
+    // the trigram index (see `--index build`). `--` ends the options (for a
+    // pattern like "-f").
+    if (argc == 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        return run_benchmark();
+    }
+    if (argc == 4 && strcmp(argv[1], "--index") == 0 && strcmp(argv[2], "build") == 0)
+    {
+        return index_build(argv[3]);
+    }
+    const char *pattern_file = NULL;
+    const char *regex = NULL;
+    int ignore_case = 0;
+    int use_index = 0;
+    int max_errors = -1; // `--fuzzy=k`, or -1 for an exact search
+    int arg = 1;
+    while (arg + 1 < argc || (arg < argc && strcmp(argv[arg], "--indexed") == 0))
+    {
+        if (strcmp(argv[arg], "-i") == 0)
+        {
+            ignore_case = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "-c") == 0)
+        {
+            g_count_only = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "-l") == 0)
+        {
+            g_list_files = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "-m") == 0)
+        {
+            char *number_end;
+            g_max_count = strtol(argv[arg + 1], &number_end, 10);
+            if (number_end == argv[arg + 1] || *number_end != '\0' || g_max_count < 0)
+            {
+                fprintf(stderr, "Error: -m needs a number of lines, like -m 10.\n");
+                return 1;
+            }
+            arg += 2;
+        }
+        else if (strncmp(argv[arg], "--fuzzy=", 8) == 0)
+        {
+            char *number_end;
+            long errors = strtol(argv[arg] + 8, &number_end, 10);
+            if (number_end == argv[arg] + 8 || *number_end != '\0' || errors < 0 || errors > 1000)
+            {
+                fprintf(stderr, "Error: --fuzzy needs a number of errors, like --fuzzy=2.\n");
+                return 1;
+            }
+            max_errors = (int)errors;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--indexed") == 0)
+        {
+            use_index = 1;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "-f") == 0 && pattern_file == NULL && regex == NULL)
+        {
+            pattern_file = argv[arg + 1];
+            arg += 2;
+        }
+        else if (strcmp(argv[arg], "-E") == 0 && pattern_file == NULL && regex == NULL)
+        {
+            regex = argv[arg + 1];
+            arg += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (arg < argc && strcmp(argv[arg], "--") == 0)
+    {
+        arg++;
+    }
+    // The pattern comes from an option, or else it is the next argument.
+    const char *pattern = pattern_file != NULL ? pattern_file : regex;
+    if (pattern == NULL && arg < argc)
     {
-        fprintf(stderr, "Usage: %s <pattern> <filename>\n", argv[0]);
+        pattern = argv[arg++];
+    }
+    int first_path = arg;
+    if (pattern == NULL || pattern[0] == '\0' || (use_index ? argc != first_path : argc <= first_path))
+    {
+        fprintf(stderr,
+                "Usage: %s [-c | -l] [-m <lines>] [-i] [-f <pattern file> | -E <regex> | --fuzzy=<k>] [<pattern>] "
+                "<file or directory>...\n",
+                argv[0]);
+        fprintf(stderr,
+                "       %s [-c | -l] [-m <lines>] [-i] [-f <pattern file> | -E <regex> | --fuzzy=<k>] --indexed "
+                "[<pattern>]\n",
+                argv[0]);
+        fprintf(stderr, "       %s --index build <directory>\n", argv[0]);
+        fprintf(stderr, "       %s --bench\n", argv[0]);
         return 1; // Return an error code.
     }
 
     // Store the arguments in clearly named variables for readability.
-    char *pattern = argv[1];
-    char *filename = argv[2];
+    char *filename = argv[first_path];
+    int path_count = argc - first_path;
+
+    // We print whole lines, so a match must not run from one line into the next.
+    if (pattern_file == NULL && strchr(pattern, '\n') != NULL)
+    {
+        fprintf(stderr, "Error: the pattern cannot contain a newline.\n");
+        return 1;
+    }
+    if (max_errors >= 0 && (pattern_file != NULL || regex != NULL))
+    {
+        fprintf(stderr, "Error: --fuzzy works with one plain pattern, not with -f or -E.\n");
+        return 1;
+    }
+    // `-l` needs just one match per file to know the file's name belongs in the list.
+    if (g_list_files && (g_max_count < 0 || g_max_count > 1))
+    {
+        g_max_count = 1;
+    }
+
+    // Study the pattern(s) once, before reading any of the file. `static`: the
+    // matcher is big, and it would be a waste of stack space.
+    static Matcher matcher;
+    matcher.ignore_case = ignore_case;
+    if (regex != NULL)
+    {
+        if (regex_compile(&matcher.regex, regex, ignore_case) != 0)
+        {
+            return 1;
+        }
+        matcher.use_regex = 1;
+    }
+    else if (pattern_file != NULL)
+    {
+        // A single pattern is still fastest with the single-pattern engine.
+        if (pattern_set_load(&matcher.set, pattern) != 0 || pattern_set_build(&matcher.set, ignore_case) != 0 ||
+            matcher_set_pattern(&matcher, matcher.set.patterns[0], matcher.set.lengths[0]) != 0)
+        {
+            matcher_free(&matcher);
+            return 1;
+        }
+    }
+    else if (matcher_set_pattern(&matcher, pattern, (long)strlen(pattern)) != 0)
+    {
+        return 1;
+    }
+    if (max_errors >= 0)
+    {
+        if (fuzzy_compile(&matcher.fuzzy, matcher.folded != NULL ? matcher.folded : pattern, (long)strlen(pattern),
+                          max_errors, ignore_case) != 0)
+        {
+            matcher_free(&matcher);
+            return 1;
+        }
+        matcher.use_fuzzy = 1;
+    }
+
+    // `--indexed`: the index says which files to search.
+    int status;
+    if (use_index)
+    {
+        status = index_search(&matcher, pattern);
+        matcher_free(&matcher);
+        return status;
+    }
+
+    // Several paths, or a directory: search them all in parallel. Each line is
+    // printed as "path:line", like `grep -r` does.
+    struct stat info;
+    if (path_count > 1 || (stat(filename, &info) == 0 && S_ISDIR(info.st_mode)))
+    {
+        print_search_header(&matcher, pattern);
+        if (path_count > 1)
+        {
+            printf("in %d paths:\n\n", path_count);
+        }
+        else
+        {
+            printf("in directory \"%s\":\n\n", filename);
+        }
+        fflush(stdout); // The header must come before any line the workers find.
+        status = search_paths(&matcher, argv + first_path, path_count);
+        matcher_free(&matcher);
+        return status;
+    }
 
     // --- Step 2: Open the File ---
 
@@ -83,44 +4377,61 @@ int main(int argc, char *argv[])
         // It prints your custom message, followed by a colon, and then the
         // system's human-readable error message for why the operation failed.
         perror("Error opening file");
+        matcher_free(&matcher);
         return 1;
     }
 
-    // --- Step 3 & 4: Read File Line by Line and Search ---
-
-    char line_buffer[2048]; // A buffer to hold one line of text from the file.
+    // --- Step 3 & 4: Read the File in Blocks and Search ---
 
-    printf("Searching for \"%s\" in file \"%s\":\n\n", pattern, filename);
+    print_search_header(&matcher, pattern);
+    printf("in file \"%s\":\n\n", filename);
 
-    // This `while` loop is the standard, safe way to read a file line-by-line.
-    // `fgets()` reads one line (or up to 2047 characters + null terminator)
-    // from `file_pointer` and stores it in `line_buffer`.
-    // It returns NULL when it reaches the end of the file, which ends the loop.
-    while (fgets(line_buffer, sizeof(line_buffer), file_pointer) != NULL)
+    // A big file is split between threads. A small one needs no threads: its
+    // matching lines go straight to the output buffer. With `-m` or `-l` we want
+    // to stop at the first matches, so the file is read from the start instead.
+    struct stat file_info;
+    status = -1;
+    if (fstat(fileno(file_pointer), &file_info) == 0 && S_ISREG(file_info.st_mode) &&
+        file_info.st_size >= PARALLEL_MIN_SIZE && count_workers() > 1 && g_max_count < 0)
     {
-        // --- The Core Logic: Searching for a Substring ---
-
-        // `strstr()` is the key function here. It searches for the first
-        // occurrence of the `pattern` string within the `line_buffer` string.
-        // - If it finds a match, it returns a POINTER to the beginning of the match.
-        // - If no match is found, it returns NULL.
-        if (strstr(line_buffer, pattern) != NULL)
+        status = search_chunks(&matcher, file_pointer, (long long)file_info.st_size);
+    }
+    if (status == -1)
+    {
+        Output output = {NULL, NULL, 0, NULL, 0, 1};
+        ReadBuffer buffer = {NULL, 0};
+        status = search_stream(&matcher, file_pointer, &buffer, &output);
+        free(buffer.data);
+        if (output_flush() != 0 && status == 0)
+        {
+            status = 1;
+        }
+        if (status == 0 && g_list_files)
+        {
+            if (output.count > 0)
+            {
+                printf("%s\n", filename);
+            }
+        }
+        else if (status == 0 && g_count_only)
         {
-            // A match was found! Print the entire line.
-            // We use `printf("%s", ...)` and not `printf("%s\n", ...)` because
-            // `fgets()` already includes the newline character `\n` at the
-            // end of the line it reads.
-            printf("%s", line_buffer);
+            printf("%ld\n", output.count);
         }
     }
+    if (status == SEARCH_BINARY)
+    {
+        fprintf(stderr, "Skipping binary file %s\n", filename);
+        status = 0;
+    }
 
     // --- Step 5: Clean Up ---
 
     // It is crucial to close the file when you are done with it.
     // `fclose()` releases the file handle back to the operating system.
     fclose(file_pointer);
+    matcher_free(&matcher);
 
-    return 0; // Success!
+    return status; // 0 means success!
 }
 
 /*
@@ -136,7 +4447,7 @@ int main(int argc, char *argv[])
  * HOW TO COMPILE AND RUN THIS CODE:
  *
  * 1. Open a terminal and compile the program:
- *    `gcc -Wall -Wextra -std=c11 -o 27_build_your_own_grep 27_build_your_own_grep.c`
+ *    `gcc -Wall -Wextra -std=c11 -pthread -o 27_build_your_own_grep 27_build_your_own_grep.c`
  *
  * 2. Run it! A great first test is to make it search for something in its own source code.
  *    Let's search for every line containing the word "main":
@@ -155,4 +4466,46 @@ int main(int argc, char *argv[])
  *    `./27_build_your_own_grep world data.txt`
  *
  *    You should see the first and third lines printed to your console.
+ *
+ * 5. See how the search engine compares with the C library's `strstr()`. Compile
+ *    with optimizations for a fair fight:
+ *    `gcc -O2 -std=c11 -pthread -o 27_build_your_own_grep 27_build_your_own_grep.c`
+ *    `./27_build_your_own_grep --bench`
+ *
+ * 6. Search a whole directory tree, or several paths at once. Every matching line
+ *    is printed with the file it came from:
+ *    `./27_build_your_own_grep main .`
+ *    `./27_build_your_own_grep world data.txt 27_build_your_own_grep.c`
+ *
+ * 7. Search for many patterns at once. Put one pattern per line in a file:
+ *    `printf 'world\nfinal\n' > patterns.txt`
+ *    `./27_build_your_own_grep -f patterns.txt data.txt`
+ *
+ * 8. Search with a regular expression. Find the lines that start with "The" or "A",
+ *    then the lines that end with "test." or "tests.":
+ *    `./27_build_your_own_grep -E '^(The|A) ' data.txt`
+ *    `./27_build_your_own_grep -E 'tests?\.$' data.txt`
+ *
+ * 9. Ignore upper and lower case. This finds the same two lines as searching for "world":
+ *    `./27_build_your_own_grep -i WORLD data.txt`
+ *    `-i` works with `-f` and `-E` too, and `--bench` shows its speed in the "-i" column.
+ *
+ * 10. Index a directory once, then search it again and again. Run both commands
+ *    from the same directory: the index is saved there as `.grep_index`.
+ *    `./27_build_your_own_grep --index build .`
+ *    `./27_build_your_own_grep --indexed main`
+ *    Change a file and build again: only the changed file is read.
+ *
+ * 11. Count the matching lines instead of printing them. Files of 32 MiB or more
+ *    are searched by all your CPUs at once:
+ *    `./27_build_your_own_grep -c world data.txt`
+ *
+ * 12. Search with typos allowed. "wurld" is one replaced letter away from "world",
+ *    so this finds the same two lines again:
+ *    `./27_build_your_own_grep --fuzzy=1 wurld data.txt`
+ *
+ * 13. Ask only what you need to know. List the files that mention "main", then
+ *    print just the first matching line of each:
+ *    `./27_build_your_own_grep -l main .`
+ *    `./27_build_your_own_grep -m 1 main .`
  */
@@ -58,97 +58,2429 @@
  *    to a global total, and then unlock the mutex.
  * 6. The main thread will wait for all worker threads to complete and then print the result.
  *
+ * STREAMING MODE: PRODUCERS AND CONSUMERS
+ * Step 1 only works for real files. We find the size with `fseek`/`ftell`, but
+ * standard input and pipes (like `zcat logs.gz | ./analyzer -`) cannot seek, and
+ * their total size is unknown until the data stops coming. When the filename is
+ * `-`, we switch to a PRODUCER-CONSUMER design instead:
+ * 1. A READER THREAD (the producer) fills a RING of fixed-size buffers from stdin.
+ * 2. WORKER THREADS (the consumers) take full buffers, count them, and hand the
+ *    empty buffers back to the reader so they can be refilled.
+ * 3. A CONDITION VARIABLE lets a thread sleep until another thread tells it that
+ *    something changed ("a buffer is full" or "a buffer is free again").
+ * The ring never grows, so memory use stays the same whether the input is 1 KB
+ * or 1 TB. While workers count one buffer, the reader is already filling the next,
+ * so the slowest part of the pipeline (usually the pipe itself) sets the pace.
+ *
+ * WORD FREQUENCIES: `--top K`
+ * Counting *which* words appear most often needs more than a number per thread.
+ * Each worker keeps its own HASH MAP from word to count (no locking, just like the
+ * local counters). Three details make this work on huge inputs:
+ * 1. CHUNK BOUNDARIES: A word belongs to the chunk where it STARTS. A worker skips
+ *    a word it joined halfway through and reads past its own end to finish its
+ *    last word. In streaming mode the reader holds back an unfinished last word
+ *    and moves it to the front of the next buffer.
+ * 2. BOUNDED MEMORY: A per-thread map never holds more than WORD_MAP_LIMIT words.
+ *    When it is full, the rarest words are evicted into a COUNT-MIN SKETCH, a small
+ *    fixed-size table of counters that can estimate (slightly over-estimate) how
+ *    often any word was seen without storing the word itself.
+ * 3. PARALLEL MERGE: Merge thread `p` collects every word whose hash satisfies
+ *    `hash % NUM_THREADS == p` from all the maps. The partitions never overlap, so
+ *    the merge needs no locks. Each merge thread then keeps its K largest counts in
+ *    a MIN-HEAP, and the main thread picks the final K from those candidates.
+ *
+ * UTF-8 MODE: `--utf8`
+ * By default a "character" is a byte. In UTF-8 text, letters like `é` or `世` take
+ * 2-4 bytes: one LEAD byte followed by CONTINUATION bytes, which always look like
+ * `10xxxxxx`. So the number of characters (CODE POINTS) is simply the number of
+ * bytes that are NOT continuation bytes. In this mode we also:
+ * - VALIDATE the text, counting bytes that do not form a legal UTF-8 sequence.
+ * - Treat Unicode whitespace (like the no-break space U+00A0 or the ideographic
+ *   space U+3000) as word separators, not just the ASCII ones `isspace` knows.
+ * Most log text is plain ASCII, so the loop looks at 16 bytes at once with SIMD
+ * (Single Instruction, Multiple Data) instructions. When all 16 bytes are ASCII,
+ * a handful of vector compares count lines, words and characters for the whole
+ * block. Only blocks containing non-ASCII bytes are decoded one code point at a time.
+ * Chunks are moved to start on a code point boundary so no character is split.
+ * The default byte mode uses the same 16-byte trick; `--kernel scalar` switches
+ * back to the simple one-byte-at-a-time loop so you can compare the two.
+ *
+ * INCREMENTAL RUNS: `--cache FILE`
+ * Log files usually only GROW: new lines are appended, old ones never change. If we
+ * remember the counts from the last run, we only need to scan the new tail and add
+ * it on. The cache stores, per file, its IDENTITY (device and inode number from
+ * `stat()`, which stay the same while a file is appended to), its size and
+ * modification time, a hash of its first and last few KiB, the counts, and
+ * whether the file ended in the middle of a word. On the next run:
+ * - Same file, same size, same mtime: nothing to scan at all.
+ * - Same file, bigger, and the hashed bytes still match: scan only the new bytes.
+ * - Anything else (rotated to a new inode, truncated, rewritten): full rescan.
+ * Re-analysis now costs time proportional to what was appended, not to the file.
+ * Every rotation leaves an entry behind for an inode that is gone, so the cache
+ * keeps only the CACHE_MAX_ENTRIES files analyzed most recently.
+ *
+ * MEASURING: `--stats` AND `--trace FILE`
+ * "Launching thread 0" tells us nothing about where the time goes. With `--stats`,
+ * every thread records when it started and finished, how many bytes it handled,
+ * how much CPU time it actually used, and how many PAGE FAULTS it took (a page
+ * fault happens when a thread touches memory the OS has not mapped in yet; a
+ * MAJOR fault has to wait for the disk). Wall time minus CPU time is time spent
+ * blocked: waiting for I/O, for the disk, or for another thread. The report also
+ * shows the JOIN SKEW, the gap between the first and the last thread to finish.
+ * A large skew means the work was not evenly balanced. The report is JSON on
+ * stderr. `--trace FILE` also writes a Chrome trace-event file that you can open
+ * in chrome://tracing or https://ui.perfetto.dev to see the threads on a timeline.
+ *
+ * WHERE THREADS RUN AND WHERE MEMORY LIVES: `--pin`, `--mmap`, `--interleave`
+ * The OS scheduler may move a thread from core to core whenever it likes. On big
+ * servers with two CPU SOCKETS, each socket has its own memory: a NUMA NODE
+ * (Non-Uniform Memory Access). Reading memory attached to the other socket is
+ * noticeably slower, and the link between sockets is shared by everyone.
+ * - `--pin` fixes each worker to one core (its CPU AFFINITY). Workers are spread
+ *   evenly over the NUMA nodes, and neighbouring chunks go to the same node.
+ * - `--mmap` maps the file into memory instead of copying it with fread(). A page
+ *   that is not in the PAGE CACHE yet is read from disk when a thread first
+ *   touches it, and the OS places it on that thread's node ("FIRST TOUCH"). So
+ *   with `--pin`, on a COLD run every chunk ends up next to the core that counts
+ *   it. Pages that are already cached stay on whichever node first read them:
+ *   on a warm run, `--mmap --pin` moves nothing.
+ * - `--interleave` spreads NEW pages (our buffers, and file pages read from disk)
+ *   round-robin over all nodes instead, so no single node's memory becomes the
+ *   bottleneck. The price: each thread now finds most of its pages on other
+ *   nodes, which is slower when they could all have been close by.
+ * On a one-socket machine these options change little. On a bigger one, measure
+ * with `--stats` before keeping either of them.
+ *
+ * DATA QUALITY: `--histogram`
+ * Before trusting a data file it helps to know its SHAPE: how long its lines are
+ * (one 50 MB "line" usually means a missing newline) and which bytes it contains
+ * (a NUL or 0xFF byte in a text log means something went wrong). With
+ * `--histogram` the analyzer also reports the longest line, line-length
+ * PERCENTILES (p50 = half the lines are at most this long) and how often each of
+ * the 256 possible byte values appears. It still reads the data only ONCE:
+ * - Each worker counts a small piece of its chunk and then updates its own
+ *   histograms from the same piece while it is still in the CPU cache.
+ * - Every thread has PRIVATE histograms, added together after the threads finish,
+ *   so counting a byte never needs a lock.
+ * - A line can start in one chunk and end in another. Each worker remembers the
+ *   length of its first (unfinished) and last (unterminated) line, and the main
+ *   thread STITCHES those pieces together in chunk order.
+ *
+ * PROGRESS: `--progress`
+ * On a multi-gigabyte file it is nice to know how far along we are. Each worker
+ * has its own ATOMIC byte counter. An atomic variable can be read by one thread
+ * while another thread writes it, without a mutex and without ever seeing a
+ * half-written value. Workers add to their counter once per 64 KiB piece, not per
+ * byte, using RELAXED memory ordering: we only need the number itself to be
+ * correct, not any ordering with other memory, so this is as cheap as a plain
+ * add. Each counter sits on its own CACHE LINE so that two workers never fight
+ * over the same line (FALSE SHARING). A separate REPORTER THREAD wakes up twice a
+ * second, sums the counters and prints the throughput and estimated time left
+ * (ETA) to stderr. Reading the counters costs the workers nothing.
+ *
  * We will use the POSIX Threads (pthreads) library, the standard for C.
  */
 
+// Ask the C library for its POSIX and Linux extras too (clock_gettime, and
+// getrusage with RUSAGE_THREAD). This must come before the first #include.
+#define _GNU_SOURCE
+
 // --- Required Headers ---
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h> // The main header for POSIX Threads
 #include <ctype.h>   // For isspace()
+#include <errno.h>   // For errno after a failed read()
+#include <unistd.h>  // For read() and STDIN_FILENO
+#include <sys/stat.h> // For stat(), the file's identity for `--cache`
+#include <sys/resource.h> // For getrusage(), per-thread page fault counts
+#include <time.h>     // For clock_gettime()
+#include <sched.h>    // For cpu_set_t and sched_getaffinity()
+#include <sys/mman.h> // For mmap()
+#include <sys/syscall.h> // For the set_mempolicy system call
+#include <stdatomic.h> // For the `--progress` byte counters
+
+#if defined(__SSE2__)
+#include <emmintrin.h> // SSE2 vector intrinsics (every x86-64 CPU has them)
+#endif
 
 // --- Constants and Global Data ---
-#define NUM_THREADS 4
+#ifndef NUM_THREADS
+#define NUM_THREADS 4 // Override when compiling, e.g. -DNUM_THREADS=8
+#endif
+#define STREAM_BUFFER_SIZE (1024 * 1024)   // Bytes per ring buffer in streaming mode
+#define STREAM_RING_SLOTS (NUM_THREADS * 2) // Enough buffers to keep every worker busy
+#define WORD_MAP_LIMIT (1 << 15)   // Most distinct words one thread tracks exactly
+#define MAX_TRACKED_WORD 128       // Longer "words" (binary junk) only go to the sketch
+#define SKETCH_DEPTH 4             // Rows in the count-min sketch
+#define SKETCH_WIDTH (1 << 14)     // Counters per row (a power of two)
+#define SKETCH_NOISE_SIGMAS 3      // An estimate must clear the noise by this many standard deviations
+#define CACHE_HASH_BYTES 4096      // Bytes hashed at each end of a cached file
+#define CACHE_MAX_ENTRIES 256      // Files the cache remembers; the least recently used go first
+#define MAX_NUMA_NODES 64
+#define LINE_LENGTH_EXACT 4096     // Line lengths below this are counted exactly
+#define PIECE_SIZE (64 * 1024)     // Bytes counted in one go with `--histogram` or `--progress`
+#define PROGRESS_INTERVAL_MS 500   // How often the `--progress` line is updated
+
+// This struct will hold the final, combined results. This is our SHARED DATA.
+typedef struct
+{
+    long long total_chars;
+    long long total_words;
+    long long total_lines;
+    long long invalid_utf8; // Only counted in `--utf8` mode
+} GlobalCounts;
+
+GlobalCounts g_counts = {0}; // Initialize global counts
+pthread_mutex_t g_mutex;           // The global MUTEX to protect g_counts
+int g_utf8_mode = 0;               // Set by `--utf8`
+int g_use_simd = 1;                // Cleared by `--kernel scalar`
+
+// --- Instrumentation for `--stats` ---
+// What one thread measured about itself. Each thread writes only its own entry,
+// so no locking is needed; main() reads them after `pthread_join`.
+typedef struct
+{
+    const char *role;    // "worker" or "reader"; NULL if the thread never ran
+    double start;        // Seconds since the program started
+    double end;
+    double cpu_seconds;  // Time actually spent running on a CPU
+    double wait_seconds; // Time spent waiting for another thread (streaming mode)
+    double io_seconds;   // Time spent inside read() (the streaming reader)
+    long long bytes;
+    long minor_faults;   // Page faults served from memory
+    long major_faults;   // Page faults that had to wait for the disk
+} ThreadStats;
+
+// A span of the main thread's work, like "read file" or "count".
+typedef struct
+{
+    const char *name;
+    double start;
+    double end;
+} PhaseStats;
+
+#define MAX_PHASES 8
+
+int g_stats_enabled = 0;                   // Set by `--stats` or `--trace`
+const char *g_trace_path = NULL;           // Set by `--trace FILE`
+double g_start_time = 0.0;
+ThreadStats g_thread_stats[NUM_THREADS + 1]; // The extra entry is the stream reader
+PhaseStats g_phases[MAX_PHASES];
+int g_phase_count = 0;
+
+// A MONOTONIC clock never jumps backwards (unlike the wall clock, which NTP may adjust).
+double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9 - g_start_time;
+}
+
+// Returns the time only when `--stats` is on, so the measuring costs nothing otherwise.
+double stats_clock(void)
+{
+    return g_stats_enabled ? now_seconds() : 0.0;
+}
+
+void stats_begin(ThreadStats *stats, const char *role)
+{
+    if (!g_stats_enabled)
+    {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->role = role;
+    stats->start = now_seconds();
+}
+
+void stats_end(ThreadStats *stats, long long bytes)
+{
+    if (!g_stats_enabled)
+    {
+        return;
+    }
+    stats->end = now_seconds();
+    stats->bytes = bytes;
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    stats->cpu_seconds = (double)cpu.tv_sec + (double)cpu.tv_nsec / 1e9;
+
+#ifdef RUSAGE_THREAD
+    // Linux can report page faults for just the calling thread.
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0)
+    {
+        stats->minor_faults = usage.ru_minflt;
+        stats->major_faults = usage.ru_majflt;
+    }
+#endif
+}
+
+void stats_phase(const char *name, double start)
+{
+    if (g_stats_enabled && g_phase_count < MAX_PHASES)
+    {
+        g_phases[g_phase_count].name = name;
+        g_phases[g_phase_count].start = start;
+        g_phases[g_phase_count].end = now_seconds();
+        g_phase_count++;
+    }
+}
+
+// --- Word Frequencies: A Hash Map per Thread ---
+// One word and how often it was seen. `word` is a malloc'd, NUL-terminated copy;
+// a NULL `word` marks an empty slot in the table.
+typedef struct
+{
+    char *word;
+    unsigned int length;
+    int approximate; // True when `count` includes a count-min sketch estimate
+    unsigned long long hash;
+    long long count;
+} WordEntry;
+
+// An OPEN ADDRESSING hash table: colliding words move to the next free slot
+// instead of being chained in a linked list (compare Lesson 28). The capacity
+// is a power of two and at most half full, so probes stay short.
+typedef struct
+{
+    WordEntry *entries;
+    size_t capacity;
+    size_t size;
+    size_t limit;               // 0 means grow freely; otherwise evict into `sketch`
+    unsigned long long *sketch; // SKETCH_DEPTH * SKETCH_WIDTH counters, or NULL
+    int out_of_memory;
+} WordMap;
+
+int g_top_k = 0;                                // K from `--top K`, or 0 when disabled
+WordMap g_word_maps[NUM_THREADS];               // One map per worker thread
+unsigned long long g_sketch[SKETCH_DEPTH * SKETCH_WIDTH]; // Sum of all evicted counts
+unsigned long long g_sketch_total = 0; // Total evicted occurrences (the sum of one row)
+double g_sketch_variance = 0;          // How much the counters of one row vary
+int g_sketch_used = 0;
+
+// --- Histograms for `--histogram` ---
+typedef struct
+{
+    unsigned long long bytes[256];                           // How often each byte value appears
+    unsigned long long line_lengths[LINE_LENGTH_EXACT];      // Lines of exactly this many bytes
+    unsigned long long long_lines[64];                       // Longer lines, by power of two
+    long long longest_line;
+} Histograms;
+
+// The lines a chunk could not measure on its own. `head` is the length of its
+// first line (which may have started in an earlier chunk) and `tail` the length
+// of the unfinished line at its end. Without any newline, `tail` is the whole chunk.
+typedef struct
+{
+    long long head;
+    long long tail;
+    int has_newline;
+} LineFragment;
+
+int g_histograms_enabled = 0;          // Set by `--histogram`
+Histograms g_histograms[NUM_THREADS];  // One private set per worker
+Histograms g_stitched_lines;           // Lines that crossed a chunk boundary
+LineFragment g_fragments[NUM_THREADS]; // Each file-mode chunk's edges
+long long g_open_line = 0;             // Length of the line still being stitched
+
+// --- Progress Counters for `--progress` ---
+// `_Alignas(64)` starts every counter on its own 64-byte cache line.
+typedef struct
+{
+    _Alignas(64) atomic_llong bytes;
+} ProgressCounter;
+
+int g_progress_enabled = 0;              // Set by `--progress`
+ProgressCounter g_progress[NUM_THREADS]; // Bytes each worker has counted so far
+
+// Everything one worker accumulates before merging it into the shared results.
+typedef struct
+{
+    GlobalCounts counts;
+    WordMap *words;         // NULL unless `--top` was given
+    Histograms *histograms; // NULL unless `--histogram` was given
+    LineFragment fragment;  // The edges of the chunk being counted
+    atomic_llong *progress; // NULL unless `--progress` was given
+} LocalStats;
+
+// This struct holds the information we need to pass to each thread.
+typedef struct
+{
+    char *data_chunk; // Pointer to the start of this thread's data
+    long chunk_size;  // How many bytes this thread should process
+    long lookahead;   // Bytes after the chunk we may read to finish our last word
+    int starts_inside_word; // True when this chunk begins in the middle of a word
+    int thread_index;
+} ThreadData;
+
+// FNV-1a: a simple, fast hash that mixes every byte into a 64-bit value.
+unsigned long long hash_word(const char *word, long length)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (long i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)word[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// The count-min sketch uses SKETCH_DEPTH different counters per word. The
+// column for row `row` is derived from two halves of the word's hash.
+size_t sketch_index(unsigned long long hash, int row)
+{
+    unsigned long long step = (hash >> 32) | 1;
+    return (size_t)row * SKETCH_WIDTH + (size_t)((hash + (unsigned long long)row * step) & (SKETCH_WIDTH - 1));
+}
+
+void sketch_add(unsigned long long *sketch, unsigned long long hash, long long count)
+{
+    for (int row = 0; row < SKETCH_DEPTH; row++)
+    {
+        sketch[sketch_index(hash, row)] += (unsigned long long)count;
+    }
+}
+
+// Other words share our counters, so every row over-estimates. The smallest row
+// is a safe upper bound. With many evicted words that bound is mostly noise, so
+// we also subtract each row's expected share of everybody else's counts
+// (`total` is the sum of one row) and take the median of the corrected rows.
+// Subtracting the average noise still leaves its random spread: among 400,000
+// one-off words, some land on counters that are well above average in every
+// row. So an estimate only counts if every corrected row clears that spread
+// (`variance` is the variance of one row's counters) by SKETCH_NOISE_SIGMAS
+// standard deviations. Anything less is indistinguishable from noise, and 0.
+unsigned long long sketch_estimate(const unsigned long long *sketch, unsigned long long hash,
+                                   unsigned long long total, double variance)
+{
+    unsigned long long upper = sketch[sketch_index(hash, 0)];
+    double corrected[SKETCH_DEPTH];
+
+    for (int row = 0; row < SKETCH_DEPTH; row++)
+    {
+        unsigned long long value = sketch[sketch_index(hash, row)];
+        if (value < upper)
+        {
+            upper = value;
+        }
+
+        // Insertion sort keeps `corrected` ordered for the median below.
+        double noise = (double)(total - value) / (SKETCH_WIDTH - 1);
+        double estimate = (double)value - noise;
+        int i = row;
+        while (i > 0 && corrected[i - 1] > estimate)
+        {
+            corrected[i] = corrected[i - 1];
+            i--;
+        }
+        corrected[i] = estimate;
+    }
+
+    // Compare squares: the smallest row against the noise's standard deviation.
+    double floor_squared = (double)SKETCH_NOISE_SIGMAS * SKETCH_NOISE_SIGMAS * variance;
+    if (corrected[0] < 0.5 || corrected[0] * corrected[0] <= floor_squared)
+    {
+        return 0;
+    }
+    double median = (corrected[(SKETCH_DEPTH - 1) / 2] + corrected[SKETCH_DEPTH / 2]) / 2.0;
+    return median < (double)upper ? (unsigned long long)(median + 0.5) : upper;
+}
+
+int word_map_init(WordMap *map, size_t capacity, size_t limit)
+{
+    memset(map, 0, sizeof(*map));
+    map->entries = calloc(capacity, sizeof(WordEntry));
+    map->capacity = capacity;
+    map->limit = limit;
+    return map->entries ? 0 : -1;
+}
+
+void word_map_free(WordMap *map)
+{
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        free(map->entries[i].word);
+    }
+    free(map->entries);
+    free(map->sketch);
+    memset(map, 0, sizeof(*map));
+}
+
+// Finds the slot holding `word`, or the empty slot where it belongs.
+WordEntry *word_map_slot(WordMap *map, const char *word, unsigned int length, unsigned long long hash)
+{
+    size_t mask = map->capacity - 1;
+    size_t i = (size_t)hash & mask;
+
+    while (map->entries[i].word != NULL)
+    {
+        WordEntry *entry = &map->entries[i];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->word, word, length) == 0)
+        {
+            return entry;
+        }
+        i = (i + 1) & mask; // Linear probing: try the next slot.
+    }
+    return &map->entries[i];
+}
+
+// Moves every entry into a table of `new_capacity` slots.
+int word_map_rehash(WordMap *map, size_t new_capacity)
+{
+    WordEntry *old_entries = map->entries;
+    size_t old_capacity = map->capacity;
+
+    map->entries = calloc(new_capacity, sizeof(WordEntry));
+    if (!map->entries)
+    {
+        map->entries = old_entries;
+        return -1;
+    }
+    map->capacity = new_capacity;
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_entries[i].word != NULL)
+        {
+            WordEntry *slot = word_map_slot(map, old_entries[i].word, old_entries[i].length, old_entries[i].hash);
+            *slot = old_entries[i];
+        }
+    }
+    free(old_entries);
+    return 0;
+}
+
+// Allocates the map's count-min sketch the first time it is needed.
+int word_map_ensure_sketch(WordMap *map)
+{
+    if (!map->sketch)
+    {
+        map->sketch = calloc(SKETCH_DEPTH * SKETCH_WIDTH, sizeof(unsigned long long));
+    }
+    return map->sketch ? 0 : -1;
+}
+
+// Makes room in a full, bounded map. We evict every word seen at most
+// `threshold` times, doubling the threshold until at least half the map is freed.
+// Their counts live on in the sketch, so they are not lost, only approximated.
+int word_map_evict(WordMap *map)
+{
+    if (word_map_ensure_sketch(map) != 0)
+    {
+        return -1;
+    }
+
+    long long threshold = 1;
+    for (;;)
+    {
+        size_t evictable = 0;
+        for (size_t i = 0; i < map->capacity; i++)
+        {
+            if (map->entries[i].word != NULL && map->entries[i].count <= threshold)
+            {
+                evictable++;
+            }
+        }
+        if (evictable >= map->size / 2)
+        {
+            break;
+        }
+        threshold *= 2;
+    }
+
+    for (size_t i = 0; i < map->capacity; i++)
+    {
+        WordEntry *entry = &map->entries[i];
+        if (entry->word != NULL && entry->count <= threshold)
+        {
+            sketch_add(map->sketch, entry->hash, entry->count);
+            free(entry->word);
+            entry->word = NULL;
+            map->size--;
+        }
+    }
+
+    // Removing entries leaves holes in the probe chains, so rebuild the table.
+    return word_map_rehash(map, map->capacity);
+}
+
+// Adds `count` to `word`. When `owned_copy` is not NULL the map takes ownership
+// of that string instead of copying the word; this makes merging cheap.
+void word_map_add(WordMap *map, const char *word, unsigned int length, unsigned long long hash,
+                  long long count, char *owned_copy)
+{
+    WordEntry *slot = word_map_slot(map, word, length, hash);
+    if (slot->word != NULL)
+    {
+        slot->count += count;
+        free(owned_copy);
+        return;
+    }
+
+    // A new word. Bounded maps evict rare words; unbounded maps grow.
+    if (map->limit != 0 && map->size >= map->limit)
+    {
+        if (word_map_evict(map) != 0)
+        {
+            map->out_of_memory = 1;
+            free(owned_copy);
+            return;
+        }
+        slot = word_map_slot(map, word, length, hash);
+    }
+    else if (map->limit == 0 && (map->size + 1) * 2 > map->capacity)
+    {
+        if (word_map_rehash(map, map->capacity * 2) != 0)
+        {
+            map->out_of_memory = 1;
+            free(owned_copy);
+            return;
+        }
+        slot = word_map_slot(map, word, length, hash);
+    }
+
+    if (!owned_copy)
+    {
+        owned_copy = malloc(length + 1);
+        if (!owned_copy)
+        {
+            map->out_of_memory = 1;
+            return;
+        }
+        memcpy(owned_copy, word, length);
+        owned_copy[length] = '\0';
+    }
+
+    slot->word = owned_copy;
+    slot->length = length;
+    slot->hash = hash;
+    slot->count = count;
+    slot->approximate = 0;
+    map->size++;
+}
+
+// Records one occurrence of a word found by the counting loop.
+void count_word(WordMap *map, const char *word, long length)
+{
+    unsigned long long hash = hash_word(word, length);
+
+    if (length > MAX_TRACKED_WORD)
+    {
+        // Not worth a map slot, but the sketch still remembers it.
+        if (word_map_ensure_sketch(map) != 0)
+        {
+            map->out_of_memory = 1;
+            return;
+        }
+        sketch_add(map->sketch, hash, 1);
+        return;
+    }
+    word_map_add(map, word, (unsigned int)length, hash, 1, NULL);
+}
+
+// --- CPU Affinity and NUMA Placement ---
+int g_pin_threads = 0;             // Set by `--pin`
+int g_use_mmap = 0;                // Set by `--mmap`
+int g_interleave = 0;              // Set by `--interleave`
+int g_worker_cpus[NUM_THREADS];    // The core each worker is pinned to
+int g_worker_nodes[NUM_THREADS];   // ...and that core's NUMA node
+unsigned long g_node_mask = 0;     // One bit per NUMA node that has usable CPUs
+
+// Parses a Linux CPU list like "0-3,8,10-11" and keeps the CPUs we may run on.
+int parse_cpu_list(const char *text, const cpu_set_t *allowed, int *cpus, int max_cpus)
+{
+    int count = 0;
+    while (*text && *text != '\n')
+    {
+        char *end;
+        long first = strtol(text, &end, 10);
+        long last = first;
+        if (end == text)
+        {
+            break;
+        }
+        if (*end == '-')
+        {
+            text = end + 1;
+            last = strtol(text, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET((int)cpu, allowed) && count < max_cpus)
+            {
+                cpus[count++] = (int)cpu;
+            }
+        }
+        text = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+// Decides which core each worker runs on. Linux describes the machine's NUMA
+// layout in /sys/devices/system/node/nodeN/cpulist. Worker i goes to node
+// i * nodes / NUM_THREADS, so consecutive chunks of the file share a node, and
+// takes the next free core of that node.
+int plan_worker_cpus(void)
+{
+    static int node_cpus[MAX_NUMA_NODES][CPU_SETSIZE];
+    int node_sizes[MAX_NUMA_NODES];
+    int node_ids[MAX_NUMA_NODES];
+    int node_count = 0;
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        perror("Error reading CPU affinity");
+        return -1;
+    }
+
+    for (int node = 0; node < MAX_NUMA_NODES; node++)
+    {
+        char path[64];
+        char text[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (!file)
+        {
+            continue;
+        }
+        int size = fgets(text, sizeof(text), file) ? parse_cpu_list(text, &allowed, node_cpus[node_count], CPU_SETSIZE) : 0;
+        fclose(file);
+        if (size > 0)
+        {
+            node_sizes[node_count] = size;
+            node_ids[node_count] = node;
+            node_count++;
+        }
+    }
+
+    if (node_count == 0)
+    {
+        // No NUMA information (or not Linux): treat all allowed CPUs as one node.
+        int size = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                node_cpus[0][size++] = cpu;
+            }
+        }
+        node_sizes[0] = size;
+        node_ids[0] = 0;
+        node_count = size > 0 ? 1 : 0;
+    }
+    if (node_count == 0)
+    {
+        fprintf(stderr, "Could not find any CPU to pin threads to\n");
+        return -1;
+    }
+
+    int next_in_node[MAX_NUMA_NODES] = {0};
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        int n = i * node_count / NUM_THREADS;
+        g_worker_cpus[i] = node_cpus[n][next_in_node[n]++ % node_sizes[n]];
+        g_worker_nodes[i] = node_ids[n];
+    }
+    for (int n = 0; n < node_count; n++)
+    {
+        g_node_mask |= 1UL << node_ids[n];
+    }
+    return 0;
+}
+
+// Prepares thread attributes so worker `index` starts on its planned core.
+// Setting the affinity before the thread starts means even its first memory
+// access happens on the right node.
+void init_worker_attr(pthread_attr_t *attr, int index)
+{
+    pthread_attr_init(attr);
+    if (g_pin_threads)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(g_worker_cpus[index], &set);
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+}
+
+// Switches the calling thread's memory policy between INTERLEAVE (pages are
+// handed out round-robin over the nodes in `g_node_mask`) and the default
+// (pages come from the node of the thread that first touches them). Threads
+// created afterwards inherit the policy. There is no C library wrapper without
+// libnuma, so we make the system call directly.
+void set_interleave_policy(int enable)
+{
+#ifdef SYS_set_mempolicy
+    const int mpol_default = 0;    // MPOL_DEFAULT in <numaif.h>
+    const int mpol_interleave = 3; // MPOL_INTERLEAVE in <numaif.h>
+    unsigned long mask = g_node_mask;
+
+    long result = enable ? syscall(SYS_set_mempolicy, mpol_interleave, &mask, sizeof(mask) * 8)
+                         : syscall(SYS_set_mempolicy, mpol_default, NULL, 0);
+    if (result != 0 && enable)
+    {
+        perror("Warning: could not interleave memory across NUMA nodes");
+    }
+#else
+    if (enable)
+    {
+        fprintf(stderr, "Warning: --interleave is not supported on this system\n");
+    }
+#endif
+}
+
+// --- The Counting Loop ---
+// Both the file mode and the streaming mode count bytes the same way, so the
+// loop lives in its own function. `in_word` tells it whether the byte just
+// before `data` was part of a word; the function returns the state after the
+// last byte so the next piece of data can continue from there. `lookahead` is
+// how many bytes after `data + size` may be read to finish the last word.
+int count_bytes(const char *data, long size, long lookahead, int in_word, LocalStats *local)
+{
+    WordMap *words = local->words;
+    long word_start = in_word ? -1 : 0; // -1: this word started in an earlier chunk
+
+    for (long i = 0; i < size; i++)
+    {
+        char c = data[i];
+        local->counts.total_chars++;
+
+        if (c == '\n')
+        {
+            local->counts.total_lines++;
+        }
+
+        if (isspace((unsigned char)c))
+        {
+            if (words && in_word && word_start >= 0)
+            {
+                count_word(words, data + word_start, i - word_start);
+            }
+            in_word = 0;
+        }
+        else if (in_word == 0)
+        {
+            in_word = 1;
+            local->counts.total_words++;
+            word_start = i;
+        }
+    }
+
+    if (words && in_word && word_start >= 0)
+    {
+        // Our last word may continue into the next chunk. It is still ours.
+        long end = size;
+        while (end < size + lookahead && !isspace((unsigned char)data[end]))
+        {
+            end++;
+        }
+        count_word(words, data + word_start, end - word_start);
+    }
+
+    return in_word;
+}
+
+#if defined(__SSE2__)
+// --- The SIMD Counting Loop ---
+// Counts one block of 16 bytes with vector compares. Each compare yields 0xFF or
+// 0x00 per byte, and `_mm_movemask_epi8` packs those into a 16-bit mask (bit i =
+// byte i), so counting becomes bit twiddling on ordinary integers. The compares
+// are signed, so bytes 0x80-0xFF are negative and never match the 9..13 range:
+// exactly what `isspace` says about them in the "C" locale.
+int count_block_simd(__m128i block, int in_word, GlobalCounts *counts)
+{
+    __m128i is_newline = _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'));
+    __m128i is_blank = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    __m128i is_control_space = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('\t' - 1)),
+                                             _mm_cmplt_epi8(block, _mm_set1_epi8('\r' + 1)));
+    unsigned int space = (unsigned int)_mm_movemask_epi8(_mm_or_si128(is_blank, is_control_space));
+
+    // A word starts at a non-space byte whose previous byte is a space. Shifting
+    // the mask by one lines every byte up with its predecessor; bit 0's
+    // predecessor is the last byte of the previous block.
+    unsigned int previous_space = (space << 1) | (in_word ? 0u : 1u);
+    unsigned int word_starts = ~space & previous_space & 0xFFFFu;
+
+    counts->total_chars += 16;
+    counts->total_lines += __builtin_popcount((unsigned int)_mm_movemask_epi8(is_newline));
+    counts->total_words += __builtin_popcount(word_starts);
+    return !(space & 0x8000u);
+}
+#endif
+
+// Same contract as `count_bytes`, 16 bytes per step. Word frequencies need the
+// position of every word, so `--top` uses the byte-at-a-time loop instead.
+int count_bytes_simd(const char *data, long size, long lookahead, int in_word, LocalStats *local)
+{
+    long i = 0;
+#if defined(__SSE2__)
+    for (; !local->words && i + 16 <= size; i += 16)
+    {
+        in_word = count_block_simd(_mm_loadu_si128((const __m128i *)(data + i)), in_word, &local->counts);
+    }
+#endif
+    // The last few bytes (or everything, without SSE2) take the scalar loop.
+    return count_bytes(data + i, size - i, lookahead, in_word, local);
+}
+
+// --- UTF-8 Mode ---
+// The characters Unicode calls "White_Space". The first line is what `isspace`
+// already knows about in the "C" locale.
+int is_unicode_space(unsigned int code_point)
+{
+    return code_point == ' ' || (code_point >= '\t' && code_point <= '\r') ||
+           code_point == 0x85 || code_point == 0xA0 || code_point == 0x1680 ||
+           (code_point >= 0x2000 && code_point <= 0x200A) || code_point == 0x2028 ||
+           code_point == 0x2029 || code_point == 0x202F || code_point == 0x205F || code_point == 0x3000;
+}
+
+// Decodes one UTF-8 sequence from at most `available` bytes. Returns its length
+// and stores the code point, or returns 0 if the bytes are not valid UTF-8. Besides
+// the basic shape, this rejects the sneaky cases: OVERLONG encodings (E0 80..9F,
+// F0 80..8F), UTF-16 SURROGATES (ED A0..BF) and values above U+10FFFF (F4 90..).
+int decode_utf8(const unsigned char *bytes, long available, unsigned int *code_point)
+{
+    unsigned char lead = bytes[0];
+    unsigned char low = 0x80;  // Allowed range of the first continuation byte
+    unsigned char high = 0xBF;
+    unsigned int value;
+    int length;
+
+    if (lead < 0x80)
+    {
+        *code_point = lead;
+        return 1;
+    }
+    else if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        length = 2;
+        value = lead & 0x1F;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        length = 3;
+        value = lead & 0x0F;
+        low = (lead == 0xE0) ? 0xA0 : 0x80;
+        high = (lead == 0xED) ? 0x9F : 0xBF;
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        length = 4;
+        value = lead & 0x07;
+        low = (lead == 0xF0) ? 0x90 : 0x80;
+        high = (lead == 0xF4) ? 0x8F : 0xBF;
+    }
+    else
+    {
+        return 0; // A continuation byte or a byte that never appears in UTF-8.
+    }
+
+    if (available < length)
+    {
+        return 0; // Truncated sequence.
+    }
+    for (int k = 1; k < length; k++)
+    {
+        if (bytes[k] < low || bytes[k] > high)
+        {
+            return 0;
+        }
+        low = 0x80;
+        high = 0xBF;
+        value = (value << 6) | (bytes[k] & 0x3F);
+    }
+
+    *code_point = value;
+    return length;
+}
+
+// True when the character that ends just before `data + offset` is part of a
+// word. In UTF-8 mode we step back to that character's lead byte and decode it.
+int ends_inside_word(const char *data, long offset)
+{
+    if (offset <= 0)
+    {
+        return 0;
+    }
+    if (!g_utf8_mode)
+    {
+        return !isspace((unsigned char)data[offset - 1]);
+    }
+
+    const unsigned char *bytes = (const unsigned char *)data;
+    long start = offset - 1;
+    while (start > 0 && offset - start < 4 && (bytes[start] & 0xC0) == 0x80)
+    {
+        start--;
+    }
+    unsigned int code_point;
+    int length = decode_utf8(bytes + start, offset - start, &code_point);
+    return length != offset - start || !is_unicode_space(code_point);
+}
+
+// The UTF-8 counting loop. Same contract as `count_bytes`, but `total_chars`
+// counts code points (bytes that are not continuation bytes).
+int count_utf8(const char *data, long size, long lookahead, int in_word, LocalStats *local)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    WordMap *words = local->words;
+    long word_start = in_word ? -1 : 0;
+    long i = 0;
+
+    while (i < size)
+    {
+        long block_end = i + 1;
+#if defined(__SSE2__)
+        // The fast path: 16 ASCII bytes at a time. The top bit of every byte goes
+        // into the mask, so a zero mask means "all ASCII". Word frequencies need the
+        // word boundaries themselves, so `--top` always takes the slow path.
+        if (g_use_simd && !words && i + 16 <= size)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i *)(bytes + i));
+            if (_mm_movemask_epi8(block) == 0)
+            {
+                in_word = count_block_simd(block, in_word, &local->counts);
+                i += 16;
+                continue;
+            }
+            block_end = i + 16; // Decode this whole block before trying SIMD again.
+        }
+#endif
+
+        // The slow path: decode and validate one code point at a time.
+        while (i < block_end && i < size)
+        {
+            unsigned int code_point = 0;
+            int length = decode_utf8(bytes + i, size - i, &code_point);
+            int is_space = 0;
+
+            if (length == 0)
+            {
+                // Invalid byte: report it and treat it as part of a word.
+                local->counts.invalid_utf8++;
+                local->counts.total_chars += (bytes[i] & 0xC0) != 0x80;
+                length = 1;
+            }
+            else
+            {
+                local->counts.total_chars++;
+                local->counts.total_lines += (code_point == '\n');
+                is_space = is_unicode_space(code_point);
+            }
+
+            if (is_space)
+            {
+                if (words && in_word && word_start >= 0)
+                {
+                    count_word(words, data + word_start, i - word_start);
+                }
+                in_word = 0;
+            }
+            else if (in_word == 0)
+            {
+                in_word = 1;
+                local->counts.total_words++;
+                word_start = i;
+            }
+            i += length;
+        }
+    }
+
+    if (words && in_word && word_start >= 0)
+    {
+        // Finish a word that continues into the next chunk, as in `count_bytes`.
+        long end = size;
+        while (end < size + lookahead)
+        {
+            unsigned int code_point = 0;
+            int length = decode_utf8(bytes + end, size + lookahead - end, &code_point);
+            if (length > 0 && is_unicode_space(code_point))
+            {
+                break;
+            }
+            end += length > 0 ? length : 1;
+        }
+        count_word(words, data + word_start, end - word_start);
+    }
+
+    return in_word;
+}
+
+// The counting loop to use, chosen once in main(). A FUNCTION POINTER (Lesson 18)
+// lets every worker call the chosen loop without an if/else of its own.
+typedef int (*CountFunction)(const char *data, long size, long lookahead, int in_word, LocalStats *local);
+CountFunction g_count_function = count_bytes;
+
+// Adds one thread's sub-totals to the shared totals.
+void merge_counts(const GlobalCounts *local)
+{
+    // This is the CRITICAL SECTION. Only one thread can be in here at a time.
+    pthread_mutex_lock(&g_mutex);
+
+    g_counts.total_chars += local->total_chars;
+    g_counts.total_words += local->total_words;
+    g_counts.total_lines += local->total_lines;
+    g_counts.invalid_utf8 += local->invalid_utf8;
+
+    pthread_mutex_unlock(&g_mutex); // Release the lock!
+}
+
+// --- Data Quality: Line Lengths and the Byte Histogram ---
+void record_line_length(Histograms *histograms, long long length)
+{
+    if (length < LINE_LENGTH_EXACT)
+    {
+        histograms->line_lengths[length]++;
+    }
+    else
+    {
+        histograms->long_lines[63 - __builtin_clzll((unsigned long long)length)]++;
+    }
+    if (length > histograms->longest_line)
+    {
+        histograms->longest_line = length;
+    }
+}
+
+// Adds one piece of a chunk to the worker's histograms. Lines that lie entirely
+// inside the chunk are recorded right away; the first and last one are only
+// measured into `local->fragment`, since they may continue in a neighbouring chunk.
+void update_histograms(const char *data, long size, LocalStats *local)
+{
+    Histograms *histograms = local->histograms;
+    LineFragment *fragment = &local->fragment;
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    for (long i = 0; i < size; i++)
+    {
+        histograms->bytes[bytes[i]]++;
+    }
+
+    // memchr() jumps from newline to newline much faster than a byte loop.
+    const char *line = data;
+    const char *end = data + size;
+    const char *newline;
+    while ((newline = memchr(line, '\n', (size_t)(end - line))) != NULL)
+    {
+        long long length = fragment->tail + (newline - line);
+        if (fragment->has_newline)
+        {
+            record_line_length(histograms, length);
+        }
+        else
+        {
+            fragment->head = length;
+            fragment->has_newline = 1;
+        }
+        fragment->tail = 0;
+        line = newline + 1;
+    }
+    fragment->tail += end - line;
+}
+
+// Joins the edges of the next chunk (in file order) onto the line that is still
+// open. Only one thread may stitch at a time, and always in chunk order.
+void stitch_fragment(const LineFragment *fragment)
+{
+    if (fragment->has_newline)
+    {
+        record_line_length(&g_stitched_lines, g_open_line + fragment->head);
+        g_open_line = fragment->tail;
+    }
+    else
+    {
+        g_open_line += fragment->tail;
+    }
+}
+
+// Counts a chunk with `g_count_function`. With `--histogram` or `--progress`,
+// the chunk is handled in pieces that fit in the CPU cache: the histograms read
+// each piece right after the counting loop has loaded it, so memory is still
+// read only once, and the progress counter is bumped once per piece.
+int count_chunk(const char *data, long size, long lookahead, int in_word, LocalStats *local)
+{
+    if (!local->histograms && !local->progress)
+    {
+        return g_count_function(data, size, lookahead, in_word, local);
+    }
+
+    memset(&local->fragment, 0, sizeof(local->fragment));
+    long offset = 0;
+    while (offset < size)
+    {
+        long piece = size - offset < PIECE_SIZE ? size - offset : PIECE_SIZE;
+        // Like the chunks themselves, pieces must not split a UTF-8 character.
+        while (g_utf8_mode && offset + piece < size && piece - PIECE_SIZE < 3 &&
+               ((unsigned char)data[offset + piece] & 0xC0) == 0x80)
+        {
+            piece++;
+        }
+
+        in_word = g_count_function(data + offset, piece, size - offset - piece + lookahead, in_word, local);
+        if (local->histograms)
+        {
+            update_histograms(data + offset, piece, local);
+        }
+        if (local->progress)
+        {
+            atomic_fetch_add_explicit(local->progress, piece, memory_order_relaxed);
+        }
+        offset += piece;
+    }
+    return in_word;
+}
+
+// --- The Worker Function ---
+// This is the function that each thread will execute.
+void *analyze_chunk(void *arg)
+{
+    ThreadData *data = (ThreadData *)arg;
+    ThreadStats *stats = &g_thread_stats[data->thread_index];
+    stats_begin(stats, "worker");
+
+    // --- Step 1: Perform analysis on local variables ---
+    // We do NOT want to lock the mutex for every character we count.
+    // That would be extremely slow and defeat the purpose of threading.
+    // Instead, each thread calculates its own sub-total.
+    LocalStats local = {{0}, g_top_k > 0 ? &g_word_maps[data->thread_index] : NULL,
+                        g_histograms_enabled ? &g_histograms[data->thread_index] : NULL, {0, 0, 0},
+                        g_progress_enabled ? &g_progress[data->thread_index].bytes : NULL};
+
+    // Continue an in-progress word across chunks
+    count_chunk(data->data_chunk, data->chunk_size, data->lookahead, data->starts_inside_word, &local);
+
+    // --- Step 2: Lock the mutex and update the global state ---
+    merge_counts(&local.counts);
+    g_fragments[data->thread_index] = local.fragment; // Stitched by main() after the join
+
+    stats_end(stats, data->chunk_size);
+    return NULL;
+}
+
+// --- Progress Reporting `--progress` ---
+typedef struct
+{
+    long long total_bytes; // 0 when the size is unknown (standard input)
+    int stop;              // Set by stop_progress()
+    pthread_mutex_t lock;
+    pthread_cond_t stopped;
+    pthread_t thread;
+} ProgressReporter;
+
+ProgressReporter g_reporter;
+
+// Prints one progress line to stderr. On a terminal, `\r` rewrites the same line.
+void print_progress(long long done, double elapsed, int final)
+{
+    double rate = elapsed > 0.0 ? (double)done / elapsed : 0.0;
+    const char *end = final ? "\n" : (isatty(STDERR_FILENO) ? "\r" : "\n");
+
+    if (g_reporter.total_bytes > 0)
+    {
+        double eta = rate > 0.0 ? (double)(g_reporter.total_bytes - done) / rate : 0.0;
+        fprintf(stderr, "Progress: %5.1f%%  %lld/%lld MiB  %.2f GB/s  ETA %.1fs   %s",
+                100.0 * (double)done / (double)g_reporter.total_bytes, done >> 20,
+                g_reporter.total_bytes >> 20, rate / 1e9, eta, end);
+    }
+    else
+    {
+        fprintf(stderr, "Progress: %lld MiB  %.2f GB/s   %s", done >> 20, rate / 1e9, end);
+    }
+}
+
+// Adds up the workers' counters. Relaxed loads are enough: a slightly stale
+// value only makes the progress line lag a little.
+long long progress_bytes(void)
+{
+    long long done = 0;
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        done += atomic_load_explicit(&g_progress[t].bytes, memory_order_relaxed);
+    }
+    return done;
+}
+
+// The REPORTER thread. `pthread_cond_timedwait` sleeps until the next update is
+// due, but wakes up at once when stop_progress() signals that the work is done.
+void *progress_reporter(void *arg)
+{
+    (void)arg;
+    double start = now_seconds();
+    struct timespec due;
+    clock_gettime(CLOCK_REALTIME, &due); // timedwait deadlines use the wall clock
+
+    pthread_mutex_lock(&g_reporter.lock);
+    while (!g_reporter.stop)
+    {
+        due.tv_nsec += PROGRESS_INTERVAL_MS * 1000000L;
+        due.tv_sec += due.tv_nsec / 1000000000L;
+        due.tv_nsec %= 1000000000L;
+        if (pthread_cond_timedwait(&g_reporter.stopped, &g_reporter.lock, &due) == ETIMEDOUT)
+        {
+            print_progress(progress_bytes(), now_seconds() - start, 0);
+        }
+    }
+    pthread_mutex_unlock(&g_reporter.lock);
+
+    print_progress(progress_bytes(), now_seconds() - start, 1);
+    return NULL;
+}
+
+void start_progress(long long total_bytes)
+{
+    if (!g_progress_enabled)
+    {
+        return;
+    }
+    g_reporter.total_bytes = total_bytes;
+    g_reporter.stop = 0;
+    pthread_mutex_init(&g_reporter.lock, NULL);
+    pthread_cond_init(&g_reporter.stopped, NULL);
+    pthread_create(&g_reporter.thread, NULL, progress_reporter, NULL);
+}
+
+void stop_progress(void)
+{
+    if (!g_progress_enabled)
+    {
+        return;
+    }
+    pthread_mutex_lock(&g_reporter.lock);
+    g_reporter.stop = 1;
+    pthread_cond_signal(&g_reporter.stopped);
+    pthread_mutex_unlock(&g_reporter.lock);
+
+    pthread_join(g_reporter.thread, NULL);
+    pthread_cond_destroy(&g_reporter.stopped);
+    pthread_mutex_destroy(&g_reporter.lock);
+}
+
+// --- Streaming Mode: The Buffer Ring ---
+// One slot of the ring. `in_use` is true from the moment the reader fills the
+// slot until a worker has finished counting it.
+typedef struct
+{
+    char *data;
+    long length;
+    int starts_inside_word; // Same idea as in ThreadData, decided by the reader
+    int in_use;
+} StreamSlot;
+
+typedef struct
+{
+    StreamSlot slots[STREAM_RING_SLOTS];
+    long long filled;  // How many buffers the reader has filled so far
+    long long claimed; // How many buffers workers have taken so far
+    long long total_bytes;
+    // `--histogram`: buffers can finish out of order, so each one leaves its line
+    // fragment here until every earlier buffer has been stitched. A buffer is only
+    // refilled after the one STREAM_RING_SLOTS before it was stitched, so the
+    // fragments fit in one entry per slot.
+    LineFragment fragments[STREAM_RING_SLOTS];
+    int fragment_ready[STREAM_RING_SLOTS];
+    long long stitched; // How many buffers have been stitched so far
+    int finished;   // True once the reader has seen end of input (or an error)
+    int read_error; // The errno of a failed read(), or 0
+    pthread_mutex_t lock;
+    pthread_cond_t slot_filled; // Signalled when workers have something to do
+    pthread_cond_t slot_freed;  // Signalled when the reader may reuse a slot
+} StreamRing;
+
+// Fills `buffer` from standard input. A pipe hands us data in small pieces, so we
+// keep calling read() until the buffer is full or the input ends. Returns the
+// number of bytes read, or -1 on error.
+long fill_from_stdin(char *buffer, long capacity)
+{
+    long length = 0;
+
+    while (length < capacity)
+    {
+        ssize_t got = read(STDIN_FILENO, buffer + length, (size_t)(capacity - length));
+        if (got < 0 && errno == EINTR)
+        {
+            continue; // Interrupted by a signal before any data arrived; try again.
+        }
+        if (got < 0)
+        {
+            return -1;
+        }
+        if (got == 0)
+        {
+            break; // End of input.
+        }
+        length += got;
+    }
+
+    return length;
+}
+
+// The PRODUCER. Fills the slots in order, waiting whenever the next slot is still
+// being counted by a worker. An unfinished word at the end of a full buffer is
+// held back and copied to the front of the next one, so every word reaches a
+// worker in one piece (unless a single "word" is longer than a whole buffer).
+void *stream_reader(void *arg)
+{
+    StreamRing *ring = (StreamRing *)arg;
+    ThreadStats *stats = &g_thread_stats[NUM_THREADS];
+    int previous_inside_word = 0;
+    StreamSlot *previous = NULL;
+    long carried = 0;
+
+    stats_begin(stats, "reader");
+    for (;;)
+    {
+        pthread_mutex_lock(&ring->lock);
+        StreamSlot *slot = &ring->slots[ring->filled % STREAM_RING_SLOTS];
+        double wait_start = stats_clock();
+        while (slot->in_use)
+        {
+            // `pthread_cond_wait` unlocks the mutex while sleeping and locks it
+            // again before returning, so workers can free slots in the meantime.
+            pthread_cond_wait(&ring->slot_freed, &ring->lock);
+        }
+        stats->wait_seconds += stats_clock() - wait_start;
+        pthread_mutex_unlock(&ring->lock);
+
+        // The slot is ours now, so we can fill it without holding the lock. Only
+        // the reader ever writes to a slot, so the held-back tail of the previous
+        // slot is still intact even if a worker has already released it.
+        if (carried > 0)
+        {
+            memcpy(slot->data, previous->data + previous->length, (size_t)carried);
+        }
+        double read_start = stats_clock();
+        long got = fill_from_stdin(slot->data + carried, STREAM_BUFFER_SIZE - carried);
+        int saved_errno = errno;
+        stats->io_seconds += stats_clock() - read_start;
+        int at_end = got < STREAM_BUFFER_SIZE - carried; // A short (or failed) read
+        long length = carried + (got > 0 ? got : 0);
+
+        carried = 0;
+        if (!at_end)
+        {
+            long cut = length;
+            while (cut > 0 && !isspace((unsigned char)slot->data[cut - 1]))
+            {
+                cut--;
+            }
+            if (cut == 0)
+            {
+                // No whitespace at all. At least avoid splitting a UTF-8 sequence.
+                cut = length;
+                while (cut > length - 4 && ((unsigned char)slot->data[cut - 1] & 0xC0) == 0x80)
+                {
+                    cut--;
+                }
+                if (cut > length - 4 && ((unsigned char)slot->data[cut - 1] & 0xC0) == 0xC0)
+                {
+                    cut--; // Hold back the lead byte together with its continuation bytes.
+                }
+                else
+                {
+                    cut = length; // Plain bytes; any split is as good as another.
+                }
+            }
+            if (cut < length)
+            {
+                carried = length - cut;
+                length = cut;
+            }
+        }
+
+        pthread_mutex_lock(&ring->lock);
+        if (got < 0)
+        {
+            ring->read_error = saved_errno;
+        }
+        if (length > 0)
+        {
+            slot->length = length;
+            slot->starts_inside_word = previous_inside_word;
+            slot->in_use = 1;
+            ring->filled++;
+            ring->total_bytes += length;
+            pthread_cond_signal(&ring->slot_filled);
+
+            // The word state at the end of this buffer is the start state of the next.
+            previous_inside_word = ends_inside_word(slot->data, length);
+        }
+        previous = slot;
+        if (at_end)
+        {
+            // The input is over. Wake every worker so the idle ones can notice and exit.
+            ring->finished = 1;
+            pthread_cond_broadcast(&ring->slot_filled);
+            pthread_mutex_unlock(&ring->lock);
+            stats_end(stats, ring->total_bytes);
+            return NULL;
+        }
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+// What each streaming worker needs to know: the shared ring and its own index.
+typedef struct
+{
+    StreamRing *ring;
+    int thread_index;
+} StreamWorkerData;
+
+// The CONSUMERS. Each worker repeatedly claims the oldest full slot, counts it,
+// and releases it back to the reader.
+void *stream_worker(void *arg)
+{
+    StreamWorkerData *worker = (StreamWorkerData *)arg;
+    StreamRing *ring = worker->ring;
+    LocalStats local = {{0}, g_top_k > 0 ? &g_word_maps[worker->thread_index] : NULL,
+                        g_histograms_enabled ? &g_histograms[worker->thread_index] : NULL, {0, 0, 0},
+                        g_progress_enabled ? &g_progress[worker->thread_index].bytes : NULL};
+    ThreadStats *stats = &g_thread_stats[worker->thread_index];
+    long long bytes = 0;
+
+    stats_begin(stats, "worker");
+    for (;;)
+    {
+        pthread_mutex_lock(&ring->lock);
+        double wait_start = stats_clock();
+        while (ring->claimed == ring->filled && !ring->finished)
+        {
+            pthread_cond_wait(&ring->slot_filled, &ring->lock);
+        }
+        stats->wait_seconds += stats_clock() - wait_start;
+        if (ring->claimed == ring->filled)
+        {
+            pthread_mutex_unlock(&ring->lock); // Finished and nothing left to count.
+            break;
+        }
+        long long sequence = ring->claimed;
+        StreamSlot *slot = &ring->slots[sequence % STREAM_RING_SLOTS];
+        ring->claimed++;
+        pthread_mutex_unlock(&ring->lock);
+
+        count_chunk(slot->data, slot->length, 0, slot->starts_inside_word, &local);
+        bytes += slot->length;
+
+        pthread_mutex_lock(&ring->lock);
+        if (local.histograms)
+        {
+            ring->fragments[sequence % STREAM_RING_SLOTS] = local.fragment;
+            ring->fragment_ready[sequence % STREAM_RING_SLOTS] = 1;
+            while (ring->fragment_ready[ring->stitched % STREAM_RING_SLOTS])
+            {
+                ring->fragment_ready[ring->stitched % STREAM_RING_SLOTS] = 0;
+                stitch_fragment(&ring->fragments[ring->stitched % STREAM_RING_SLOTS]);
+                ring->stitched++;
+            }
+        }
+        slot->in_use = 0;
+        pthread_cond_signal(&ring->slot_freed);
+        pthread_mutex_unlock(&ring->lock);
+    }
+
+    merge_counts(&local.counts);
+    stats_end(stats, bytes);
+    return NULL;
+}
+
+// Runs the whole streaming pipeline on standard input. Returns 0 on success.
+int analyze_stream(void)
+{
+    StreamRing ring;
+    memset(&ring, 0, sizeof(ring));
+
+    for (int i = 0; i < STREAM_RING_SLOTS; i++)
+    {
+        ring.slots[i].data = malloc(STREAM_BUFFER_SIZE);
+        if (!ring.slots[i].data)
+        {
+            fprintf(stderr, "Could not allocate stream buffers\n");
+            for (int j = 0; j < i; j++)
+            {
+                free(ring.slots[j].data);
+            }
+            return 1;
+        }
+    }
+
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.slot_filled, NULL);
+    pthread_cond_init(&ring.slot_freed, NULL);
+    pthread_mutex_init(&g_mutex, NULL);
+
+    printf("Streaming from standard input through %d buffers of %d KiB.\n",
+           STREAM_RING_SLOTS, STREAM_BUFFER_SIZE / 1024);
+
+    pthread_t reader;
+    pthread_t workers[NUM_THREADS];
+    StreamWorkerData worker_args[NUM_THREADS];
+    pthread_create(&reader, NULL, stream_reader, &ring);
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        worker_args[i].ring = &ring;
+        worker_args[i].thread_index = i;
+        printf("Launching stream worker %d.\n", i);
+
+        pthread_attr_t attr;
+        init_worker_attr(&attr, i);
+        pthread_create(&workers[i], &attr, stream_worker, &worker_args[i]);
+        pthread_attr_destroy(&attr);
+    }
+
+    pthread_join(reader, NULL);
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        pthread_join(workers[i], NULL);
+        printf("Thread %d finished.\n", i);
+    }
+
+    pthread_cond_destroy(&ring.slot_freed);
+    pthread_cond_destroy(&ring.slot_filled);
+    pthread_mutex_destroy(&ring.lock);
+    pthread_mutex_destroy(&g_mutex);
+    for (int i = 0; i < STREAM_RING_SLOTS; i++)
+    {
+        free(ring.slots[i].data);
+    }
+
+    if (ring.read_error != 0)
+    {
+        fprintf(stderr, "Error reading standard input: %s\n", strerror(ring.read_error));
+        return 1;
+    }
+
+    printf("Successfully read %lld bytes from standard input.\n", ring.total_bytes);
+    return 0;
+}
+
+// --- Word Frequencies: Parallel Merge and Top-K Selection ---
+// Orders entries by count, breaking ties alphabetically so the report is stable.
+// Returns true when `a` should rank below `b`.
+int entry_ranks_lower(const WordEntry *a, const WordEntry *b)
+{
+    if (a->count != b->count)
+    {
+        return a->count < b->count;
+    }
+    return strcmp(a->word, b->word) > 0;
+}
+
+// Offers one candidate to a MIN-HEAP of at most `k` entries. The root is always
+// the weakest of the current top K, so a newcomer only has to beat the root.
+void heap_offer(WordEntry **heap, int *size, int k, WordEntry *candidate)
+{
+    int i;
+    if (*size < k)
+    {
+        i = (*size)++;
+        // Sift up: swap with the parent while we rank lower than it.
+        while (i > 0 && entry_ranks_lower(candidate, heap[(i - 1) / 2]))
+        {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = candidate;
+        return;
+    }
+    if (k == 0 || !entry_ranks_lower(heap[0], candidate))
+    {
+        return;
+    }
+
+    // Replace the root and sift down: swap with the lower-ranked child.
+    i = 0;
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= *size)
+        {
+            break;
+        }
+        if (child + 1 < *size && entry_ranks_lower(heap[child + 1], heap[child]))
+        {
+            child++;
+        }
+        if (!entry_ranks_lower(heap[child], candidate))
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = candidate;
+}
+
+// One merge thread's share of the work.
+typedef struct
+{
+    int partition;
+    WordMap merged;
+    WordEntry **top; // Min-heap of this partition's K best entries
+    int top_size;
+} MergeTask;
+
+void *merge_partition(void *arg)
+{
+    MergeTask *task = (MergeTask *)arg;
+
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        WordMap *source = &g_word_maps[t];
+        for (size_t i = 0; i < source->capacity; i++)
+        {
+            WordEntry *entry = &source->entries[i];
+            // Check the (never modified) hash first: entries of other partitions
+            // belong to other merge threads and must not be touched.
+            if ((int)(entry->hash % NUM_THREADS) != task->partition || entry->word == NULL)
+            {
+                continue;
+            }
+            // Hand the string over to the merged map instead of copying it.
+            word_map_add(&task->merged, entry->word, entry->length, entry->hash, entry->count, entry->word);
+            entry->word = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < task->merged.capacity; i++)
+    {
+        WordEntry *entry = &task->merged.entries[i];
+        if (entry->word == NULL)
+        {
+            continue;
+        }
+        if (g_sketch_used)
+        {
+            // Occurrences evicted from some thread's map live on in the sketch.
+            unsigned long long extra = sketch_estimate(g_sketch, entry->hash, g_sketch_total, g_sketch_variance);
+            entry->count += (long long)extra;
+            entry->approximate = extra > 0;
+        }
+        heap_offer(task->top, &task->top_size, g_top_k, entry);
+    }
+
+    return NULL;
+}
+
+// qsort() comparator for the final report: highest count first.
+int compare_entries_descending(const void *a, const void *b)
+{
+    const WordEntry *left = *(WordEntry *const *)a;
+    const WordEntry *right = *(WordEntry *const *)b;
+    if (entry_ranks_lower(left, right))
+    {
+        return 1;
+    }
+    return entry_ranks_lower(right, left) ? -1 : 0;
+}
+
+// Merges the per-thread maps and prints the K most frequent words. Returns 0 on success.
+int report_top_words(void)
+{
+    // Combine the per-thread sketches first; the merge threads only read it.
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        if (g_word_maps[t].out_of_memory)
+        {
+            fprintf(stderr, "Could not allocate memory for word counts\n");
+            return 1;
+        }
+        if (g_word_maps[t].sketch)
+        {
+            g_sketch_used = 1;
+            for (int i = 0; i < SKETCH_DEPTH * SKETCH_WIDTH; i++)
+            {
+                g_sketch[i] += g_word_maps[t].sketch[i];
+            }
+        }
+    }
+    double sum_of_squares = 0;
+    for (int i = 0; i < SKETCH_WIDTH; i++)
+    {
+        g_sketch_total += g_sketch[i];
+        sum_of_squares += (double)g_sketch[i] * (double)g_sketch[i];
+    }
+    double mean = (double)g_sketch_total / SKETCH_WIDTH;
+    g_sketch_variance = sum_of_squares / SKETCH_WIDTH - mean * mean;
+
+    pthread_t threads[NUM_THREADS];
+    MergeTask tasks[NUM_THREADS];
+    int failed = 0;
+    for (int p = 0; p < NUM_THREADS; p++)
+    {
+        tasks[p].partition = p;
+        tasks[p].top_size = 0;
+        tasks[p].top = malloc((size_t)g_top_k * sizeof(WordEntry *));
+        if (word_map_init(&tasks[p].merged, 1024, 0) != 0 || !tasks[p].top)
+        {
+            // Leave the remaining tasks empty so the cleanup below stays simple.
+            fprintf(stderr, "Could not allocate memory for word counts\n");
+            free(tasks[p].top);
+            word_map_free(&tasks[p].merged);
+            for (int q = 0; q < p; q++)
+            {
+                free(tasks[q].top);
+                word_map_free(&tasks[q].merged);
+            }
+            return 1;
+        }
+    }
+    for (int p = 0; p < NUM_THREADS; p++)
+    {
+        pthread_create(&threads[p], NULL, merge_partition, &tasks[p]);
+    }
+
+    WordEntry **top = malloc((size_t)g_top_k * sizeof(WordEntry *));
+    int top_size = 0;
+    size_t distinct = 0;
+    for (int p = 0; p < NUM_THREADS; p++)
+    {
+        pthread_join(threads[p], NULL);
+        failed |= tasks[p].merged.out_of_memory;
+        distinct += tasks[p].merged.size;
+        for (int i = 0; top && i < tasks[p].top_size; i++)
+        {
+            heap_offer(top, &top_size, g_top_k, tasks[p].top[i]);
+        }
+    }
+
+    if (!top || failed)
+    {
+        fprintf(stderr, "Could not allocate memory for word counts\n");
+    }
+    else
+    {
+        qsort(top, (size_t)top_size, sizeof(WordEntry *), compare_entries_descending);
+
+        printf("\n--- Top %d Words ---\n", g_top_k);
+        for (int i = 0; i < top_size; i++)
+        {
+            printf("%4d. %-24s %c%lld\n", i + 1, top[i]->word, top[i]->approximate ? '~' : ' ', top[i]->count);
+        }
+        printf("Distinct words tracked: %zu\n", distinct);
+        if (g_sketch_used)
+        {
+            printf("Counts marked ~ include count-min sketch estimates for evicted words. Other counts\n"
+                   "may miss a few evicted occurrences, too few to tell apart from the sketch's noise.\n");
+        }
+        printf("-------------------------\n");
+    }
+
+    free(top);
+    for (int p = 0; p < NUM_THREADS; p++)
+    {
+        free(tasks[p].top);
+        word_map_free(&tasks[p].merged);
+    }
+    return (!top || failed) ? 1 : 0;
+}
+
+// --- Incremental Runs: The Analysis Cache ---
+// Everything we remember about one file. The cache file is plain text, one
+// entry per line, so you can open it and see what the analyzer remembered.
+typedef struct
+{
+    unsigned long long device;
+    unsigned long long inode;
+    long long size;
+    long long mtime;
+    unsigned long long partial_hash; // Hash of the first and last CACHE_HASH_BYTES
+    int utf8_mode;                   // Counts from the other mode do not mix
+    int ends_inside_word;            // The `in_word` state after the last byte
+    GlobalCounts counts;
+} CacheEntry;
+
+#define CACHE_HEADER "analyzer-cache v1"
+
+// Reads every entry of the cache file. A missing cache file simply means an empty
+// cache. Returns 0 on success, -1 if the file exists but could not be read.
+int load_cache(const char *path, CacheEntry **entries, size_t *count)
+{
+    *entries = NULL;
+    *count = 0;
+
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    char header[64];
+    if (!fgets(header, sizeof(header), file) || strncmp(header, CACHE_HEADER, strlen(CACHE_HEADER)) != 0)
+    {
+        fclose(file);
+        return 0; // Unknown format: ignore it and rebuild the cache from scratch.
+    }
+
+    CacheEntry entry;
+    while (fscanf(file, "%llu %llu %lld %lld %llx %d %d %lld %lld %lld %lld",
+                  &entry.device, &entry.inode, &entry.size, &entry.mtime, &entry.partial_hash,
+                  &entry.utf8_mode, &entry.ends_inside_word, &entry.counts.total_chars,
+                  &entry.counts.total_words, &entry.counts.total_lines, &entry.counts.invalid_utf8) == 11)
+    {
+        CacheEntry *grown = realloc(*entries, (*count + 1) * sizeof(CacheEntry));
+        if (!grown)
+        {
+            fclose(file);
+            return -1;
+        }
+        *entries = grown;
+        (*entries)[(*count)++] = entry;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Writes the cache to a temporary file and then renames it over the old one.
+// `rename()` replaces the file in one step, so a crash mid-write (or two runs
+// at once) can never leave a half-written cache behind. The entries are in
+// order of last use, and only the newest CACHE_MAX_ENTRIES are kept.
+int save_cache(const char *path, const CacheEntry *entries, size_t count)
+{
+    char temp_path[4096];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path))
+    {
+        return -1;
+    }
+
+    FILE *file = fopen(temp_path, "w");
+    if (!file)
+    {
+        return -1;
+    }
+
+    fprintf(file, "%s\n", CACHE_HEADER);
+    for (size_t i = count > CACHE_MAX_ENTRIES ? count - CACHE_MAX_ENTRIES : 0; i < count; i++)
+    {
+        const CacheEntry *entry = &entries[i];
+        fprintf(file, "%llu %llu %lld %lld %llx %d %d %lld %lld %lld %lld\n",
+                entry->device, entry->inode, entry->size, entry->mtime, entry->partial_hash,
+                entry->utf8_mode, entry->ends_inside_word, entry->counts.total_chars,
+                entry->counts.total_words, entry->counts.total_lines, entry->counts.invalid_utf8);
+    }
+
+    if (fclose(file) != 0 || rename(temp_path, path) != 0)
+    {
+        remove(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+CacheEntry *find_cache_entry(CacheEntry *entries, size_t count, const struct stat *info)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (entries[i].device == (unsigned long long)info->st_dev &&
+            entries[i].inode == (unsigned long long)info->st_ino && entries[i].utf8_mode == g_utf8_mode)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Hashes the first and the last CACHE_HASH_BYTES of the first `size` bytes of
+// the file. If either region changed, the file was not just appended to.
+// Returns 0 on success.
+int partial_file_hash(FILE *file, long size, unsigned long long *hash)
+{
+    char buffer[2 * CACHE_HASH_BYTES];
+    long head = size < CACHE_HASH_BYTES ? size : CACHE_HASH_BYTES;
+    long tail_start = size - CACHE_HASH_BYTES > head ? size - CACHE_HASH_BYTES : head;
+    long tail = size - tail_start;
+
+    if (fseek(file, 0, SEEK_SET) != 0 || fread(buffer, 1, (size_t)head, file) != (size_t)head ||
+        fseek(file, tail_start, SEEK_SET) != 0 || fread(buffer + head, 1, (size_t)tail, file) != (size_t)tail)
+    {
+        return -1;
+    }
+
+    *hash = hash_word(buffer, head + tail);
+    return 0;
+}
+
+// Prints the combined totals once every thread has finished.
+void print_results(void)
+{
+    printf("\n--- Analysis Complete ---\n");
+    printf("Total Characters: %lld\n", g_counts.total_chars);
+    printf("Total Words:      %lld\n", g_counts.total_words);
+    printf("Total Lines:      %lld\n", g_counts.total_lines);
+    if (g_utf8_mode)
+    {
+        printf("Invalid UTF-8:    %lld bytes\n", g_counts.invalid_utf8);
+    }
+    printf("-------------------------\n");
+}
+
+// Returns the length of the line at position `rank` (counting from 1) when all
+// lines are sorted by length. Above LINE_LENGTH_EXACT, only the power of two is
+// known, so the bucket's lower bound is returned and `*exact` is cleared.
+long long line_length_at_rank(const Histograms *histograms, unsigned long long rank, int *exact)
+{
+    unsigned long long seen = 0;
+
+    *exact = 1;
+    for (long long length = 0; length < LINE_LENGTH_EXACT; length++)
+    {
+        seen += histograms->line_lengths[length];
+        if (seen >= rank)
+        {
+            return length;
+        }
+    }
+    *exact = 0;
+    for (int bucket = 0; bucket < 64; bucket++)
+    {
+        seen += histograms->long_lines[bucket];
+        if (seen >= rank)
+        {
+            return 1LL << bucket;
+        }
+    }
+    return histograms->longest_line;
+}
 
-// This struct will hold the final, combined results. This is our SHARED DATA.
-typedef struct
+// Adds up the workers' private histograms and prints the data-quality report.
+void report_histograms(void)
 {
-    long long total_chars;
-    long long total_words;
-    long long total_lines;
-} GlobalCounts;
+    Histograms *total = &g_stitched_lines;
+    unsigned long long lines = 0;
+    unsigned long long buckets[65] = {0}; // 0, 1, 2-3, 4-7, ... bytes
+    unsigned long long largest_bucket = 0;
+    int last_bucket = 0;
 
-GlobalCounts g_counts = {0, 0, 0}; // Initialize global counts
-pthread_mutex_t g_mutex;           // The global MUTEX to protect g_counts
+    if (g_open_line > 0)
+    {
+        record_line_length(total, g_open_line); // A last line without a final newline
+        g_open_line = 0;
+    }
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            total->bytes[b] += g_histograms[t].bytes[b];
+        }
+        for (int length = 0; length < LINE_LENGTH_EXACT; length++)
+        {
+            total->line_lengths[length] += g_histograms[t].line_lengths[length];
+        }
+        for (int bucket = 0; bucket < 64; bucket++)
+        {
+            total->long_lines[bucket] += g_histograms[t].long_lines[bucket];
+        }
+        if (g_histograms[t].longest_line > total->longest_line)
+        {
+            total->longest_line = g_histograms[t].longest_line;
+        }
+    }
 
-// This struct holds the information we need to pass to each thread.
-typedef struct
+    for (int length = 0; length < LINE_LENGTH_EXACT; length++)
+    {
+        int bucket = length == 0 ? 0 : 64 - __builtin_clzll((unsigned long long)length);
+        buckets[bucket] += total->line_lengths[length];
+        lines += total->line_lengths[length];
+    }
+    for (int bucket = 0; bucket < 64; bucket++)
+    {
+        buckets[bucket + 1] += total->long_lines[bucket];
+        lines += total->long_lines[bucket];
+    }
+    for (int bucket = 0; bucket < 65; bucket++)
+    {
+        if (buckets[bucket] > 0)
+        {
+            last_bucket = bucket;
+            largest_bucket = buckets[bucket] > largest_bucket ? buckets[bucket] : largest_bucket;
+        }
+    }
+
+    printf("\n--- Line Lengths (bytes, without the newline) ---\n");
+    printf("Lines measured:   %llu\n", lines);
+    printf("Longest line:     %lld bytes\n", total->longest_line);
+    if (lines > 0)
+    {
+        static const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        {
+            unsigned long long rank = (unsigned long long)(percentiles[i] / 100.0 * (double)lines + 0.999999);
+            int exact;
+            long long length = line_length_at_rank(total, rank > 0 ? rank : 1, &exact);
+            printf("p%-5g            %s%lld bytes\n", percentiles[i], exact ? "" : ">= ", length);
+        }
+        for (int bucket = 0; bucket <= last_bucket; bucket++)
+        {
+            long long low = bucket == 0 ? 0 : 1LL << (bucket - 1);
+            long long high = bucket == 0 ? 0 : (1LL << bucket) - 1;
+            int bar = (int)(40 * buckets[bucket] / largest_bucket);
+            printf("%10lld-%-10lld %12llu %.*s\n", low, high, buckets[bucket], bar,
+                   "########################################");
+        }
+    }
+
+    printf("\n--- Byte Histogram (non-zero bytes only) ---\n");
+    int column = 0;
+    for (int b = 0; b < 256; b++)
+    {
+        if (total->bytes[b] == 0)
+        {
+            continue;
+        }
+        printf("%s0x%02X %c %12llu", column % 4 == 0 ? "" : "   ", (unsigned int)b, isprint(b) ? b : '.',
+               total->bytes[b]);
+        if (++column % 4 == 0)
+        {
+            printf("\n");
+        }
+    }
+    if (column % 4 != 0)
+    {
+        printf("\n");
+    }
+    printf("-------------------------\n");
+}
+
+// --- Reporting `--stats` and `--trace` ---
+double gigabytes_per_second(long long bytes, double seconds)
 {
-    char *data_chunk; // Pointer to the start of this thread's data
-    long chunk_size;  // How many bytes this thread should process
-    int starts_inside_word; // True when this chunk begins in the middle of a word
-} ThreadData;
+    return seconds > 0.0 ? (double)bytes / seconds / 1e9 : 0.0;
+}
 
-// --- The Worker Function ---
-// This is the function that each thread will execute.
-void *analyze_chunk(void *arg)
+// Writes the measurements as JSON to stderr, keeping stdout for the usual report.
+void report_stats(double wall_seconds)
 {
-    ThreadData *data = (ThreadData *)arg;
+    long long total_bytes = 0;
+    double first_end = 0.0, last_end = 0.0, shortest = 0.0, longest = 0.0;
+    int workers = 0;
 
-    // --- Step 1: Perform analysis on local variables ---
-    // We do NOT want to lock the mutex for every character we count.
-    // That would be extremely slow and defeat the purpose of threading.
-    // Instead, each thread calculates its own sub-total.
-    long long local_chars = 0;
-    long long local_words = 0;
-    long long local_lines = 0;
-    int in_word = data->starts_inside_word; // Continue an in-progress word across chunks
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        ThreadStats *stats = &g_thread_stats[i];
+        if (!stats->role)
+        {
+            continue;
+        }
+        double seconds = stats->end - stats->start;
+        if (workers == 0 || stats->end < first_end)
+        {
+            first_end = stats->end;
+        }
+        if (workers == 0 || stats->end > last_end)
+        {
+            last_end = stats->end;
+        }
+        if (workers == 0 || seconds < shortest)
+        {
+            shortest = seconds;
+        }
+        if (workers == 0 || seconds > longest)
+        {
+            longest = seconds;
+        }
+        total_bytes += stats->bytes;
+        workers++;
+    }
+
+    fprintf(stderr, "{\n");
+    fprintf(stderr, "  \"mode\": \"%s\",\n", g_thread_stats[NUM_THREADS].role ? "stream" : "file");
+    fprintf(stderr, "  \"kernel\": \"%s%s\",\n", g_utf8_mode ? "utf8-" : "", g_use_simd ? "simd" : "scalar");
+    fprintf(stderr, "  \"io\": \"%s\",\n", g_use_mmap ? "mmap" : "read");
+    fprintf(stderr, "  \"worker_threads\": %d,\n", workers);
+    fprintf(stderr, "  \"wall_seconds\": %.6f,\n", wall_seconds);
+    fprintf(stderr, "  \"bytes\": %lld,\n", total_bytes);
+    fprintf(stderr, "  \"gb_per_second\": %.3f,\n", gigabytes_per_second(total_bytes, wall_seconds));
+    // How far apart the workers finished, and how much longer the slowest ran than the fastest.
+    fprintf(stderr, "  \"join_skew_seconds\": %.6f,\n", last_end - first_end);
+    fprintf(stderr, "  \"slowest_to_fastest\": %.3f,\n", shortest > 0.0 ? longest / shortest : 0.0);
 
-    for (long i = 0; i < data->chunk_size; i++)
+    fprintf(stderr, "  \"phases\": [");
+    for (int i = 0; i < g_phase_count; i++)
     {
-        char c = data->data_chunk[i];
-        local_chars++;
+        fprintf(stderr, "%s\n    {\"name\": \"%s\", \"start_seconds\": %.6f, \"seconds\": %.6f}",
+                i > 0 ? "," : "", g_phases[i].name, g_phases[i].start, g_phases[i].end - g_phases[i].start);
+    }
+    fprintf(stderr, "\n  ],\n");
 
-        if (c == '\n')
+    fprintf(stderr, "  \"threads\": [");
+    int printed = 0;
+    for (int i = 0; i <= NUM_THREADS; i++)
+    {
+        ThreadStats *stats = &g_thread_stats[i];
+        if (!stats->role)
         {
-            local_lines++;
+            continue;
         }
+        double seconds = stats->end - stats->start;
+        double blocked = seconds > stats->cpu_seconds ? seconds - stats->cpu_seconds : 0.0;
+        fprintf(stderr,
+                "%s\n    {\"thread\": %d, \"role\": \"%s\", \"start_seconds\": %.6f, \"seconds\": %.6f, "
+                "\"bytes\": %lld, \"gb_per_second\": %.3f, \"cpu_seconds\": %.6f, \"blocked_seconds\": %.6f, "
+                "\"wait_seconds\": %.6f, \"io_seconds\": %.6f, \"minor_faults\": %ld, \"major_faults\": %ld}",
+                printed++ > 0 ? "," : "", i, stats->role, stats->start, seconds, stats->bytes,
+                gigabytes_per_second(stats->bytes, seconds), stats->cpu_seconds, blocked, stats->wait_seconds,
+                stats->io_seconds, stats->minor_faults, stats->major_faults);
+    }
+    fprintf(stderr, "\n  ]\n}\n");
+}
 
-        if (isspace((unsigned char)c))
+// Writes a Chrome trace-event file: one "complete" event (ph "X") per phase and
+// per thread, with times in microseconds. Each thread gets its own row (tid).
+// Returns 0 on success.
+int write_trace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        return -1;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"main\"}}");
+    for (int i = 0; i < g_phase_count; i++)
+    {
+        fprintf(file, ",\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}",
+                g_phases[i].name, g_phases[i].start * 1e6, (g_phases[i].end - g_phases[i].start) * 1e6);
+    }
+    for (int i = 0; i <= NUM_THREADS; i++)
+    {
+        ThreadStats *stats = &g_thread_stats[i];
+        if (!stats->role)
         {
-            in_word = 0;
+            continue;
         }
-        else if (in_word == 0)
+        fprintf(file, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+                i + 1, stats->role, i);
+        fprintf(file,
+                ",\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                "\"args\": {\"bytes\": %lld, \"cpu_ms\": %.3f, \"wait_ms\": %.3f, \"io_ms\": %.3f, \"major_faults\": %ld}}",
+                stats->role, i + 1, stats->start * 1e6, (stats->end - stats->start) * 1e6, stats->bytes,
+                stats->cpu_seconds * 1e3, stats->wait_seconds * 1e3, stats->io_seconds * 1e3, stats->major_faults);
+    }
+    fprintf(file, "\n]}\n");
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// Frees the file buffer, or unmaps it if it came from `--mmap`.
+void release_input(char *buffer, void *mapping, size_t mapping_size)
+{
+    if (mapping)
+    {
+        munmap(mapping, mapping_size);
+    }
+    else
+    {
+        free(buffer);
+    }
+}
+
+// Sets up one bounded word map per worker when `--top` was given.
+int init_word_maps(void)
+{
+    for (int t = 0; g_top_k > 0 && t < NUM_THREADS; t++)
+    {
+        if (word_map_init(&g_word_maps[t], WORD_MAP_LIMIT * 2, WORD_MAP_LIMIT) != 0)
         {
-            in_word = 1;
-            local_words++;
+            fprintf(stderr, "Could not allocate memory for word counts\n");
+            return 1;
         }
     }
+    return 0;
+}
 
-    // --- Step 2: Lock the mutex and update the global state ---
-    // This is the CRITICAL SECTION. Only one thread can be in here at a time.
-    pthread_mutex_lock(&g_mutex);
+void free_word_maps(void)
+{
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        word_map_free(&g_word_maps[t]);
+    }
+}
 
-    g_counts.total_chars += local_chars;
-    g_counts.total_words += local_words;
-    g_counts.total_lines += local_lines;
+// Prints every requested report. Returns the program's exit status.
+int finish_analysis(void)
+{
+    int status = 0;
 
-    pthread_mutex_unlock(&g_mutex); // Release the lock!
+    print_results();
+    if (g_histograms_enabled)
+    {
+        report_histograms();
+    }
+    if (g_top_k > 0)
+    {
+        double merge_start = stats_clock();
+        status = report_top_words();
+        stats_phase("top-k merge", merge_start);
+    }
+    free_word_maps();
 
-    return NULL;
+    if (g_stats_enabled)
+    {
+        report_stats(now_seconds());
+    }
+    if (g_trace_path && write_trace(g_trace_path) != 0)
+    {
+        perror("Error writing trace file");
+        status = 1;
+    }
+    return status;
+}
+
+void print_usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--top K] [--utf8] [--histogram] [--cache FILE] [--stats] [--trace FILE]\n"
+            "       [--pin] [--mmap] [--interleave] [--kernel scalar|simd] [--progress] <filename | ->\n",
+            program);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    // All timestamps are measured from here.
+    g_start_time = now_seconds();
+
+    // --- Parse the command line ---
+    const char *filename = NULL;
+    const char *cache_path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+        {
+            char *endptr = NULL;
+            errno = 0;
+            long k = strtol(argv[++i], &endptr, 10);
+            if (errno != 0 || endptr == argv[i] || *endptr != '\0' || k < 1 || k > 100000)
+            {
+                fprintf(stderr, "Error: --top needs a whole number between 1 and 100000.\n");
+                return 1;
+            }
+            g_top_k = (int)k;
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            cache_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            g_stats_enabled = 1;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            g_stats_enabled = 1;
+            g_trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--pin") == 0)
+        {
+            g_pin_threads = 1;
+        }
+        else if (strcmp(argv[i], "--mmap") == 0)
+        {
+            g_use_mmap = 1;
+        }
+        else if (strcmp(argv[i], "--interleave") == 0)
+        {
+            g_interleave = 1;
+        }
+        else if (strcmp(argv[i], "--utf8") == 0)
+        {
+            g_utf8_mode = 1;
+        }
+        else if (strcmp(argv[i], "--histogram") == 0)
+        {
+            g_histograms_enabled = 1;
+        }
+        else if (strcmp(argv[i], "--progress") == 0)
+        {
+            g_progress_enabled = 1;
+        }
+        else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc &&
+                 (strcmp(argv[i + 1], "scalar") == 0 || strcmp(argv[i + 1], "simd") == 0))
+        {
+            g_use_simd = strcmp(argv[++i], "simd") == 0;
+        }
+        else if (filename == NULL && strncmp(argv[i], "--", 2) != 0)
+        {
+            filename = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (filename == NULL)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Pick the counting loop once; every worker calls it through the pointer.
+    if (g_utf8_mode)
+    {
+        g_count_function = count_utf8;
+    }
+    else
+    {
+        g_count_function = g_use_simd ? count_bytes_simd : count_bytes;
+    }
+
+    if (cache_path && (g_top_k > 0 || g_histograms_enabled || strcmp(filename, "-") == 0))
     {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+        // The cache only stores totals, and a pipe has no identity to key it by.
+        fprintf(stderr, "Error: --cache works with a regular file and without --top or --histogram.\n");
         return 1;
     }
 
+    // --- Decide where threads run and where memory goes ---
+    if (g_pin_threads || g_interleave)
+    {
+        if (plan_worker_cpus() != 0)
+        {
+            return 1;
+        }
+        for (int i = 0; g_pin_threads && i < NUM_THREADS; i++)
+        {
+            printf("Pinning thread %d to CPU %d (NUMA node %d).\n", i, g_worker_cpus[i], g_worker_nodes[i]);
+        }
+        if (g_interleave)
+        {
+            // From here on, this thread's new pages (and those of the threads it
+            // creates) are spread over all nodes.
+            set_interleave_policy(1);
+        }
+    }
+
+    // --- Streaming mode: a filename of "-" means standard input ---
+    if (strcmp(filename, "-") == 0)
+    {
+        double stream_start = stats_clock();
+        if (init_word_maps() != 0)
+        {
+            free_word_maps();
+            return 1;
+        }
+        start_progress(0);
+        int stream_status = analyze_stream();
+        stop_progress();
+        if (stream_status != 0)
+        {
+            free_word_maps();
+            return 1;
+        }
+        stats_phase("stream", stream_start);
+
+        return finish_analysis();
+    }
+
     // --- Read entire file into memory ---
-    FILE *file = fopen(argv[1], "rb");
+    double read_start = stats_clock();
+    FILE *file = fopen(filename, "rb");
     if (!file)
     {
         perror("Error opening file");
@@ -170,87 +2502,227 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (fseek(file, 0, SEEK_SET) != 0)
+    // --- Consult the cache: maybe only the end of the file is new ---
+    long scan_start = 0;        // Where in the file our scan begins
+    int starts_inside_word = 0; // The word state just before `scan_start`
+    CacheEntry *cache = NULL;
+    size_t cache_count = 0;
+    struct stat info;
+    if (cache_path)
+    {
+        if (stat(filename, &info) != 0 || load_cache(cache_path, &cache, &cache_count) != 0)
+        {
+            perror("Error reading cache");
+            fclose(file);
+            return 1;
+        }
+
+        CacheEntry *entry = find_cache_entry(cache, cache_count, &info);
+        unsigned long long hash = 0;
+        if (entry && entry->size <= file_size && !(entry->size == file_size && entry->mtime != (long long)info.st_mtime) &&
+            partial_file_hash(file, (long)entry->size, &hash) == 0 && hash == entry->partial_hash)
+        {
+            printf("Cache hit: reusing counts for the first %lld bytes.\n", entry->size);
+            scan_start = (long)entry->size;
+            starts_inside_word = entry->ends_inside_word;
+            g_counts = entry->counts;
+        }
+        else if (entry)
+        {
+            printf("Cache entry is stale (file truncated or rewritten); rescanning.\n");
+        }
+    }
+
+    if (fseek(file, scan_start, SEEK_SET) != 0)
     {
         perror("Error rewinding file");
+        free(cache);
         fclose(file);
         return 1;
     }
 
+    long scan_size = file_size - scan_start;
     char *file_buffer = NULL;
-    if (file_size > 0)
+    void *mapping = NULL; // Set when the file is mapped with `--mmap`
+    size_t mapping_size = 0;
+    if (scan_size > 0 && g_use_mmap)
     {
-        file_buffer = malloc((size_t)file_size);
+        // mmap() offsets must be a multiple of the page size, so map from the
+        // start of the page that holds `scan_start` and skip the bytes before it.
+        // No data is copied yet. A worker's first touch maps each page in, and
+        // reads it from disk if it is not cached already.
+        long page_size = sysconf(_SC_PAGESIZE);
+        long map_start = scan_start - scan_start % page_size;
+        mapping_size = (size_t)(file_size - map_start);
+        mapping = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fileno(file), map_start);
+        if (mapping == MAP_FAILED)
+        {
+            perror("Error mapping file");
+            free(cache);
+            fclose(file);
+            return 1;
+        }
+        file_buffer = (char *)mapping + (scan_start - map_start);
     }
-
-    if (file_size > 0 && !file_buffer)
+    else if (scan_size > 0)
     {
-        fprintf(stderr, "Could not allocate memory for file\n");
-        fclose(file);
-        return 1;
+        file_buffer = malloc((size_t)scan_size);
+        if (!file_buffer)
+        {
+            fprintf(stderr, "Could not allocate memory for file\n");
+            free(cache);
+            fclose(file);
+            return 1;
+        }
+
+        if (fread(file_buffer, 1, (size_t)scan_size, file) != (size_t)scan_size)
+        {
+            fprintf(stderr, "Error reading file\n");
+            free(file_buffer);
+            free(cache);
+            fclose(file);
+            return 1;
+        }
     }
 
-    if (file_size > 0 && fread(file_buffer, 1, (size_t)file_size, file) != (size_t)file_size)
+    // Remember what the file looks like now, for the next run.
+    CacheEntry updated;
+    if (cache_path && partial_file_hash(file, file_size, &updated.partial_hash) != 0)
     {
         fprintf(stderr, "Error reading file\n");
-        free(file_buffer);
+        release_input(file_buffer, mapping, mapping_size);
+        free(cache);
         fclose(file);
         return 1;
     }
     fclose(file);
-    printf("Successfully read %ld bytes from %s.\n", file_size, argv[1]);
+    stats_phase("read file", read_start);
+    printf("Successfully read %ld bytes from %s.\n", scan_size, filename);
 
-    if (file_size == 0)
+    if (init_word_maps() != 0)
     {
-        printf("File is empty. Nothing to analyze.\n");
-        printf("\n--- Analysis Complete ---\n");
-        printf("Total Characters: %lld\n", g_counts.total_chars);
-        printf("Total Words:      %lld\n", g_counts.total_words);
-        printf("Total Lines:      %lld\n", g_counts.total_lines);
-        printf("-------------------------\n");
-        return 0;
+        free_word_maps();
+        release_input(file_buffer, mapping, mapping_size);
+        free(cache);
+        return 1;
+    }
+
+    if (scan_size == 0)
+    {
+        printf(file_size == 0 ? "File is empty. Nothing to analyze.\n" : "No new data since the last run.\n");
     }
 
     // --- Initialize Threads and Mutex ---
     pthread_t threads[NUM_THREADS];
     ThreadData thread_args[NUM_THREADS];
     pthread_mutex_init(&g_mutex, NULL); // Initialize the mutex
+    double count_start = stats_clock();
+    if (scan_size > 0)
+    {
+        start_progress(scan_size);
+    }
 
-    long chunk_size = file_size / NUM_THREADS;
-    for (int i = 0; i < NUM_THREADS; i++)
+    long chunk_size = scan_size / NUM_THREADS;
+    long chunk_starts[NUM_THREADS + 1];
+    for (int i = 0; i <= NUM_THREADS; i++)
+    {
+        chunk_starts[i] = (i == NUM_THREADS) ? scan_size : i * chunk_size;
+
+        // In UTF-8 mode, slide the boundary forward past continuation bytes so
+        // that every multi-byte character lies entirely inside one chunk.
+        while (g_utf8_mode && i > 0 && chunk_starts[i] < scan_size &&
+               ((unsigned char)file_buffer[chunk_starts[i]] & 0xC0) == 0x80 &&
+               chunk_starts[i] - i * chunk_size < 3)
+        {
+            chunk_starts[i]++;
+        }
+    }
+
+    for (int i = 0; scan_size > 0 && i < NUM_THREADS; i++)
     {
-        long chunk_start = i * chunk_size;
+        long chunk_start = chunk_starts[i];
 
         thread_args[i].data_chunk = file_buffer + chunk_start;
-        thread_args[i].chunk_size = (i == NUM_THREADS - 1) ? (file_size - chunk_start) : chunk_size;
+        thread_args[i].chunk_size = chunk_starts[i + 1] - chunk_start;
+        thread_args[i].lookahead = scan_size - chunk_starts[i + 1];
+        thread_args[i].thread_index = i;
         thread_args[i].starts_inside_word =
-            (chunk_start > 0 && !isspace((unsigned char)file_buffer[chunk_start - 1]));
+            (i == 0) ? starts_inside_word : ends_inside_word(file_buffer, chunk_start);
 
         printf("Launching thread %d to process %ld bytes.\n", i, thread_args[i].chunk_size);
         // `pthread_create` starts a new thread executing `analyze_chunk`
         // and passes it a pointer to its `thread_args`.
-        pthread_create(&threads[i], NULL, analyze_chunk, &thread_args[i]);
+        pthread_attr_t attr;
+        init_worker_attr(&attr, i);
+        pthread_create(&threads[i], &attr, analyze_chunk, &thread_args[i]);
+        pthread_attr_destroy(&attr);
     }
 
     // --- Wait for all threads to complete ---
-    for (int i = 0; i < NUM_THREADS; i++)
+    for (int i = 0; scan_size > 0 && i < NUM_THREADS; i++)
     {
         // `pthread_join` blocks the main thread until the specified thread finishes.
         pthread_join(threads[i], NULL);
         printf("Thread %d finished.\n", i);
     }
+    if (scan_size > 0)
+    {
+        stop_progress();
+    }
+    for (int i = 0; g_histograms_enabled && scan_size > 0 && i < NUM_THREADS; i++)
+    {
+        stitch_fragment(&g_fragments[i]); // In chunk order, so lines join up correctly
+    }
+    stats_phase("count", count_start);
+
+    // --- Update the cache with the new totals ---
+    if (cache_path)
+    {
+        // This file's entry moves to the end: it is now the most recently used.
+        CacheEntry *entry = find_cache_entry(cache, cache_count, &info);
+        if (entry)
+        {
+            memmove(entry, entry + 1, (size_t)(cache + cache_count - entry - 1) * sizeof(CacheEntry));
+            entry = &cache[cache_count - 1];
+        }
+        else
+        {
+            CacheEntry *grown = realloc(cache, (cache_count + 1) * sizeof(CacheEntry));
+            if (grown)
+            {
+                cache = grown;
+                entry = &cache[cache_count++];
+            }
+        }
+
+        updated.device = (unsigned long long)info.st_dev;
+        updated.inode = (unsigned long long)info.st_ino;
+        updated.size = file_size;
+        updated.mtime = (long long)info.st_mtime;
+        updated.utf8_mode = g_utf8_mode;
+        updated.ends_inside_word = scan_size > 0 ? ends_inside_word(file_buffer, scan_size) : starts_inside_word;
+        updated.counts = g_counts;
+
+        if (entry)
+        {
+            *entry = updated;
+        }
+        if (!entry || save_cache(cache_path, cache, cache_count) != 0)
+        {
+            fprintf(stderr, "Warning: could not update cache %s\n", cache_path);
+        }
+        free(cache);
+    }
 
     // --- Clean up and Print Results ---
     pthread_mutex_destroy(&g_mutex); // Always destroy the mutex
-    free(file_buffer);
-
-    printf("\n--- Analysis Complete ---\n");
-    printf("Total Characters: %lld\n", g_counts.total_chars);
-    printf("Total Words:      %lld\n", g_counts.total_words);
-    printf("Total Lines:      %lld\n", g_counts.total_lines);
-    printf("-------------------------\n");
+    release_input(file_buffer, mapping, mapping_size);
+    if (g_interleave)
+    {
+        set_interleave_policy(0);
+    }
 
-    return 0;
+    return finish_analysis();
 }
 
 /*
@@ -284,4 +2756,38 @@ int main(int argc, char *argv[])
  *
  * 4. You can also run it on its own source code for a more readable result:
  *    `./30_multithreaded_file_analyzer 30_multithreaded_file_analyzer.c`
+ *
+ * 5. Pass `-` as the filename to stream from standard input, e.g. a pipe:
+ *    `zcat logs.gz | ./30_multithreaded_file_analyzer -`
+ *
+ * 6. Add `--top K` to also list the K most frequent words:
+ *    `./30_multithreaded_file_analyzer --top 10 30_multithreaded_file_analyzer.c`
+ *
+ * 7. Add `--utf8` to count Unicode characters and check that the file is valid UTF-8:
+ *    `./30_multithreaded_file_analyzer --utf8 multilingual.log`
+ *
+ * 8. Add `--cache FILE` when re-running on a log that keeps growing. The second
+ *    run only reads what was appended since the first:
+ *    `./30_multithreaded_file_analyzer --cache analyzer.cache app.log`
+ *
+ * 9. Add `--stats` to see per-thread timings as JSON (on stderr), and `--trace FILE`
+ *    to get a timeline for chrome://tracing or https://ui.perfetto.dev:
+ *    `./30_multithreaded_file_analyzer --stats --trace trace.json large_test_file.txt 2> stats.json`
+ *
+ * 10. On a multi-socket machine, compare placements with `--stats`. `numactl` can
+ *    also fake a bad layout on purpose, e.g. threads on node 0 but memory on node 1:
+ *    `./30_multithreaded_file_analyzer --stats --pin --mmap large_test_file.txt`
+ *    `./30_multithreaded_file_analyzer --stats --interleave large_test_file.txt`
+ *    `numactl --cpunodebind=0 --membind=1 ./30_multithreaded_file_analyzer --stats large_test_file.txt`
+ *
+ * 11. To measure how well the program scales, run the benchmark script from the
+ *    repository root. It builds one binary per thread count (`-DNUM_THREADS=N`),
+ *    generates several kinds of test data and prints GB/s and speedup tables:
+ *    `BENCH_MB=256 BENCH_THREADS="1 2 4 8" sh scripts/bench_analyzer.sh`
+ *
+ * 12. Add `--histogram` to check a data file's line lengths and byte values:
+ *    `./30_multithreaded_file_analyzer --histogram app.log`
+ *
+ * 13. Add `--progress` to watch the throughput and time left while a big file runs:
+ *    `./30_multithreaded_file_analyzer --progress large_test_file.txt`
  */
@@ -0,0 +1,275 @@
+#!/bin/sh
+
+# Scaling benchmark for lesson 30, the multithreaded file analyzer.
+#
+# Generates reproducible test corpora, runs the analyzer over every combination
+# of corpus, thread count, counting kernel (scalar/simd) and input method
+# (read/mmap), and prints GB/s, speedup and parallel efficiency tables.
+# GB/s is shown twice: over the whole run, and over the "count" phase of
+# --stats alone. Reading the file is the same work for every thread count, so
+# speedup and efficiency come from the count phase, where the threads work.
+# Results are stored per commit in bench_results/<commit>.tsv and compared with
+# the previous results file so that regressions stand out.
+#
+# Everything is configurable through the environment, for example:
+#   BENCH_MB=256 BENCH_THREADS="1 2 4 8 16" sh scripts/bench_analyzer.sh
+#   BENCH_BASELINE=bench_results/abc1234.tsv sh scripts/bench_analyzer.sh
+
+set -eu
+
+CC=${CC:-cc}
+BENCH_CFLAGS=${BENCH_CFLAGS:--O2}
+BENCH_MB=${BENCH_MB:-64}
+BENCH_THREADS=${BENCH_THREADS:-1 2 4 8}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_CORPORA=${BENCH_CORPORA:-english longlines whitespace binary utf8}
+BENCH_KERNELS=${BENCH_KERNELS:-scalar simd}
+BENCH_IO=${BENCH_IO:-read mmap}
+BENCH_SEED=${BENCH_SEED:-42}
+
+ROOT_DIR=$(CDPATH= cd -- "$(dirname -- "$0")/.." && pwd)
+ANALYZER_SOURCE="$ROOT_DIR/Part 4 - The Expert Path_ Systems and Concurrency/30_multithreaded_file_analyzer.c"
+RESULTS_DIR=${BENCH_RESULTS_DIR:-$ROOT_DIR/bench_results}
+BUILD_DIR=$(mktemp -d "${TMPDIR:-/tmp}/cftgu-bench.XXXXXX")
+
+cleanup() {
+    rm -rf "$BUILD_DIR"
+}
+
+trap cleanup EXIT INT TERM HUP
+
+# The corpus generator uses its own xorshift random number generator instead of
+# awk's rand(), so the same seed produces the same bytes on every machine.
+build_generator() {
+    cat > "$BUILD_DIR/corpus_generator.c" <<'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long long state;
+
+static unsigned long long next_random(void)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/* Small ranks are much more likely than large ones, roughly like word
+ * frequencies in real text (Zipf's law). */
+static size_t skewed_index(size_t count)
+{
+    size_t limit = 1 + (size_t)(next_random() % count);
+    return (size_t)(next_random() % limit);
+}
+
+static const char *english[] = {
+    "the", "of", "and", "to", "a", "in", "is", "it", "that", "was", "for", "on", "are", "with",
+    "as", "be", "at", "this", "have", "from", "or", "by", "one", "had", "not", "but", "what",
+    "all", "were", "when", "we", "there", "can", "an", "your", "which", "their", "said", "if",
+    "will", "each", "about", "how", "up", "out", "them", "then", "she", "many", "some", "so",
+    "these", "would", "other", "into", "has", "more", "her", "two", "like", "him", "see",
+    "time", "could", "no", "make", "than", "first", "been", "its", "who", "now", "people",
+    "request", "server", "error", "warning", "connection", "timeout", "user", "session",
+    "thread", "memory", "latency", "database", "cache", "response", "handler", "status",
+};
+
+static const char *unicode[] = {
+    "\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82",     /* привет */
+    "\xce\xba\xce\xb1\xce\xbb\xce\xb7\xce\xbc\xce\xad\xcf\x81\xce\xb1", /* καλημέρα */
+    "\xe4\xb8\x96\xe7\x95\x8c",                             /* 世界 */
+    "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e",                 /* 日本語 */
+    "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4",                 /* 한국어 */
+    "caf\xc3\xa9", "na\xc3\xafve", "gr\xc3\xbc\xc3\x9f" "e", "se\xc3\xb1or",
+    "\xf0\x9f\x98\x80",                                     /* emoji */
+    "log", "id",
+};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+int main(int argc, char *argv[])
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "Usage: %s <kind> <bytes> <seed>\n", argv[0]);
+        return 1;
+    }
+
+    const char *kind = argv[1];
+    long long remaining = atoll(argv[2]);
+    state = 0x9E3779B97F4A7C15ULL ^ (unsigned long long)atoll(argv[3]) ^ (unsigned long long)strlen(kind);
+    long long line_length = 0;
+    char buffer[64];
+
+    while (remaining > 0)
+    {
+        size_t length;
+
+        if (strcmp(kind, "binary") == 0)
+        {
+            for (length = 0; length < sizeof(buffer); length++)
+            {
+                buffer[length] = (char)(next_random() & 0xFF);
+            }
+        }
+        else if (strcmp(kind, "whitespace") == 0)
+        {
+            static const char blanks[] = "        \t\t\n\r";
+            for (length = 0; length < sizeof(buffer); length++)
+            {
+                buffer[length] = blanks[next_random() % (sizeof(blanks) - 1)];
+            }
+        }
+        else
+        {
+            int use_unicode = strcmp(kind, "utf8") == 0;
+            long long wrap = strcmp(kind, "longlines") == 0 ? 1024 * 1024 : 60 + (long long)(next_random() % 40);
+            const char *word = use_unicode ? unicode[skewed_index(COUNT(unicode))] : english[skewed_index(COUNT(english))];
+            const char *separator = " ";
+
+            if (line_length >= wrap)
+            {
+                separator = "\n";
+                line_length = 0;
+            }
+            else if (use_unicode && next_random() % 8 == 0)
+            {
+                separator = "\xe3\x80\x80"; /* U+3000 IDEOGRAPHIC SPACE */
+            }
+            else if (!use_unicode && next_random() % 12 == 0)
+            {
+                separator = ", ";
+            }
+            length = (size_t)snprintf(buffer, sizeof(buffer), "%s%s", word, separator);
+            line_length += (long long)length;
+        }
+
+        if ((long long)length > remaining)
+        {
+            length = (size_t)remaining;
+        }
+        fwrite(buffer, 1, length, stdout);
+        remaining -= (long long)length;
+    }
+
+    return 0;
+}
+EOF
+
+    "$CC" -O2 "$BUILD_DIR/corpus_generator.c" -o "$BUILD_DIR/corpus_generator"
+}
+
+# NUM_THREADS is a compile-time constant in the lesson, so build one binary per count.
+build_analyzers() {
+    for threads in $BENCH_THREADS; do
+        "$CC" $BENCH_CFLAGS -DNUM_THREADS="$threads" "$ANALYZER_SOURCE" -o "$BUILD_DIR/analyzer_$threads" -pthread
+    done
+}
+
+# Prints the best (lowest) wall time and the best "count" phase time of
+# BENCH_REPEAT runs, read from --stats.
+time_run() {
+    binary=$1
+    shift
+    best=
+    best_count=
+    run=0
+    while [ "$run" -lt "$BENCH_REPEAT" ]; do
+        stats=$("$binary" --stats "$@" 2>&1 >/dev/null)
+        seconds=$(printf '%s\n' "$stats" | sed -n 's/.*"wall_seconds": \([0-9.]*\).*/\1/p')
+        count_seconds=$(printf '%s\n' "$stats" | sed -n 's/.*"name": "count".*"seconds": \([0-9.]*\).*/\1/p')
+        if [ -z "$best" ] || awk -v a="$seconds" -v b="$best" 'BEGIN { exit !(a < b) }'; then
+            best=$seconds
+        fi
+        if [ -z "$best_count" ] || awk -v a="$count_seconds" -v b="$best_count" 'BEGIN { exit !(a < b) }'; then
+            best_count=$count_seconds
+        fi
+        run=$((run + 1))
+    done
+    printf '%s %s\n' "$best" "$best_count"
+}
+
+commit=$(git -C "$ROOT_DIR" rev-parse --short HEAD 2>/dev/null || echo unknown)
+if [ -n "$(git -C "$ROOT_DIR" status --porcelain --untracked-files=no 2>/dev/null)" ]; then
+    commit="$commit-dirty"
+fi
+mkdir -p "$RESULTS_DIR"
+RESULTS_FILE="$RESULTS_DIR/$commit.tsv"
+corpus_bytes=$((BENCH_MB * 1024 * 1024))
+
+printf 'Benchmark commit: %s\n' "$commit"
+printf 'Benchmark compiler: %s %s\n' "$CC" "$BENCH_CFLAGS"
+printf 'Corpus size: %s MiB, best of %s runs\n' "$BENCH_MB" "$BENCH_REPEAT"
+
+build_generator
+build_analyzers
+
+printf '# host=%s cpus=%s mb=%s cc=%s\n' "$(uname -n)" "$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo '?')" \
+    "$BENCH_MB" "$CC" > "$RESULTS_FILE"
+
+for corpus in $BENCH_CORPORA; do
+    corpus_file=$BUILD_DIR/$corpus.txt
+    "$BUILD_DIR/corpus_generator" "$corpus" "$corpus_bytes" "$BENCH_SEED" > "$corpus_file"
+    mode_flag=
+    if [ "$corpus" = utf8 ]; then
+        mode_flag=--utf8
+    fi
+
+    for kernel in $BENCH_KERNELS; do
+        for io in $BENCH_IO; do
+            io_flag=
+            if [ "$io" = mmap ]; then
+                io_flag=--mmap
+            fi
+
+            printf '\n%s / %s / %s\n' "$corpus${mode_flag:+ (utf8 mode)}" "$kernel" "$io"
+            printf '%8s %10s %11s %10s %11s\n' threads "wall GB/s" "count GB/s" speedup efficiency
+            base_seconds=
+            for threads in $BENCH_THREADS; do
+                times=$(time_run "$BUILD_DIR/analyzer_$threads" --kernel "$kernel" $io_flag $mode_flag "$corpus_file")
+                seconds=${times% *}
+                count_seconds=${times#* }
+                if [ -z "$base_seconds" ]; then
+                    base_seconds=$count_seconds
+                    base_threads=$threads
+                fi
+                awk -v t="$threads" -v s="$seconds" -v c="$count_seconds" -v b="$base_seconds" -v bt="$base_threads" \
+                    -v bytes="$corpus_bytes" 'BEGIN {
+                    speedup = (c > 0) ? b / c : 0
+                    rate = (s > 0) ? bytes / s / 1e9 : 0
+                    count_rate = (c > 0) ? bytes / c / 1e9 : 0
+                    printf "%8d %10.3f %11.3f %9.2fx %10.0f%%\n", t, rate, count_rate, speedup, 100 * speedup * bt / t
+                }'
+                printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' "$corpus" "$kernel" "$io" "$threads" "$seconds" \
+                    "$(awk -v s="$seconds" -v bytes="$corpus_bytes" 'BEGIN { printf "%.3f", (s > 0) ? bytes / s / 1e9 : 0 }')" \
+                    "$count_seconds" \
+                    "$(awk -v s="$count_seconds" -v bytes="$corpus_bytes" 'BEGIN { printf "%.3f", (s > 0) ? bytes / s / 1e9 : 0 }')" \
+                    >> "$RESULTS_FILE"
+            done
+        done
+    done
+    rm -f "$corpus_file"
+done
+
+printf '\nResults saved to %s\n' "$RESULTS_FILE"
+
+# Compare with an explicit baseline, or with the most recent other results file.
+baseline=${BENCH_BASELINE:-$(ls -t "$RESULTS_DIR"/*.tsv 2>/dev/null | grep -v -F -x "$RESULTS_FILE" | head -n 1 || true)}
+if [ -n "$baseline" ] && [ -f "$baseline" ]; then
+    # Count-phase GB/s, or wall GB/s against results files from before that column.
+    printf '\nComparison with %s (count GB/s, or wall GB/s for older files; changes beyond 5%% are flagged)\n' \
+        "$(basename "$baseline")"
+    awk -F '\t' '
+        FNR == NR { if ($0 !~ /^#/) { old[$1 FS $2 FS $3 FS $4] = $6; old_count[$1 FS $2 FS $3 FS $4] = $8 } next }
+        $0 ~ /^#/ { next }
+        {
+            key = $1 FS $2 FS $3 FS $4
+            before = old_count[key] != "" ? old_count[key] : old[key]
+            now = old_count[key] != "" ? $8 : $6
+            if (!(key in old) || before == 0) next
+            change = 100 * (now - before) / before
+            flag = change < -5 ? "  <-- slower" : (change > 5 ? "  faster" : "")
+            printf "%-11s %-6s %-4s %3d threads: %8.3f -> %8.3f (%+6.1f%%)%s\n", $1, $2, $3, $4, before, now, change, flag
+        }' "$baseline" "$RESULTS_FILE"
+fi
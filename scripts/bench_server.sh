@@ -0,0 +1,112 @@
+#!/bin/sh
+
+# Scaling benchmark for lesson 26, the socket server.
+#
+# Runs the server with `--threads 1`, `--threads 2`, ... and loads every run
+# with several `--load` client processes at once: one client is a single thread
+# and cannot keep more than about one server core busy. Prints replies/s,
+# speedup and p99 per thread count, as the clients saw it and as the server
+# measured it.
+#
+# Everything is configurable through the environment, for example:
+#   BENCH_THREADS="1 2 4 8" BENCH_CLIENTS=8 sh scripts/bench_server.sh
+#   BENCH_RATE=200000 BENCH_DURATION=10 sh scripts/bench_server.sh
+#
+# The clients run on the same machine and compete with the server for its
+# cores. For clean numbers give the server more cores than it uses, or pin the
+# clients elsewhere with BENCH_CLIENT_PREFIX="taskset -c 8-15".
+
+set -eu
+
+CC=${CC:-cc}
+BENCH_CFLAGS=${BENCH_CFLAGS:--O2}
+CPUS=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+BENCH_THREADS=${BENCH_THREADS:-$(n=1; while [ "$n" -lt "$CPUS" ]; do printf '%s ' "$n"; n=$((n * 2)); done; echo "$CPUS")}
+BENCH_CLIENTS=${BENCH_CLIENTS:-$CPUS}
+BENCH_CONNECTIONS=${BENCH_CONNECTIONS:-100}
+BENCH_PIPELINE=${BENCH_PIPELINE:-1}
+BENCH_DURATION=${BENCH_DURATION:-5}
+BENCH_RATE=${BENCH_RATE:-}
+BENCH_PORT=${BENCH_PORT:-18888}
+BENCH_CLIENT_PREFIX=${BENCH_CLIENT_PREFIX:-}
+
+ROOT_DIR=$(CDPATH= cd -- "$(dirname -- "$0")/.." && pwd)
+LESSON_DIR="$ROOT_DIR/Part 4 - The Expert Path_ Systems and Concurrency"
+BUILD_DIR=$(mktemp -d "${TMPDIR:-/tmp}/cftgu-bench.XXXXXX")
+SERVER_PID=
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill -TERM "$SERVER_PID" >/dev/null 2>&1 || true
+    fi
+    rm -rf "$BUILD_DIR"
+}
+
+trap cleanup EXIT INT TERM HUP
+
+"$CC" $BENCH_CFLAGS "$LESSON_DIR/26_simple_socket_server.c" -o "$BUILD_DIR/server" -pthread
+"$CC" $BENCH_CFLAGS "$LESSON_DIR/26_simple_socket_client.c" -o "$BUILD_DIR/client"
+
+# Open loop: the total rate is shared by the clients. Closed loop otherwise.
+load_flags="--connections $BENCH_CONNECTIONS --duration $BENCH_DURATION"
+if [ -n "$BENCH_RATE" ]; then
+    load_flags="$load_flags --rate $(awk -v r="$BENCH_RATE" -v c="$BENCH_CLIENTS" 'BEGIN { printf "%g", r / c }')"
+    load_mode="open loop, $BENCH_RATE requests/s in total"
+else
+    load_flags="$load_flags --pipeline $BENCH_PIPELINE"
+    load_mode="closed loop, $BENCH_PIPELINE in flight per connection"
+fi
+
+printf 'Benchmark compiler: %s %s\n' "$CC" "$BENCH_CFLAGS"
+printf 'Load: %s client processes x %s connections for %s s, %s\n' "$BENCH_CLIENTS" "$BENCH_CONNECTIONS" \
+    "$BENCH_DURATION" "$load_mode"
+printf '\n%8s %12s %9s %16s %16s\n' threads replies/s speedup "client p99 ms" "server p99 ms"
+
+base_rate=
+for threads in $BENCH_THREADS; do
+    server_log=$BUILD_DIR/server_$threads.log
+    "$BUILD_DIR/server" --quiet --threads "$threads" --pin "$BENCH_PORT" > "$server_log" 2>&1 &
+    SERVER_PID=$!
+    for _ in 1 2 3 4 5 6 7 8 9 10; do
+        if grep -F "Waiting for incoming connections" "$server_log" >/dev/null 2>&1; then
+            break
+        fi
+        sleep 0.2
+    done
+    if ! grep -F "Waiting for incoming connections" "$server_log" >/dev/null 2>&1; then
+        printf 'The server did not start:\n' >&2
+        cat "$server_log" >&2
+        exit 1
+    fi
+
+    client_pids=
+    client=1
+    while [ "$client" -le "$BENCH_CLIENTS" ]; do
+        $BENCH_CLIENT_PREFIX "$BUILD_DIR/client" --load $load_flags 127.0.0.1 "$BENCH_PORT" "ping" \
+            > "$BUILD_DIR/client_$client.log" 2>&1 &
+        client_pids="$client_pids $!"
+        client=$((client + 1))
+    done
+    for client_pid in $client_pids; do
+        wait "$client_pid" || true
+    done
+
+    kill -INT "$SERVER_PID"
+    wait "$SERVER_PID" || true
+    SERVER_PID=
+
+    # Throughput adds up over the clients. Percentiles do not add up, so the
+    # clients' column shows the worst client's p99.
+    rate=$(cat "$BUILD_DIR"/client_*.log | sed -n 's/.*received \([0-9]*\) replies in \([0-9.]*\) s.*/\1 \2/p' |
+        awk '$2 > 0 { sum += $1 / $2 } END { printf "%.0f", sum }')
+    client_p99=$(cat "$BUILD_DIR"/client_*.log | sed -n 's/^ *p99 *\([0-9.]*\) ms$/\1/p' |
+        awk 'NR == 1 || $1 > worst { worst = $1 } END { printf "%.3f", worst }')
+    server_p99=$(sed -n 's/^Served .* p99 reply time \([0-9.]*\) ms\.$/\1/p' "$server_log")
+    if [ -z "$base_rate" ]; then
+        base_rate=$rate
+    fi
+    awk -v t="$threads" -v r="$rate" -v b="$base_rate" -v c="$client_p99" -v s="${server_p99:-0}" 'BEGIN {
+        printf "%8d %12d %8.2fx %16.3f %16.3f\n", t, r, (b > 0) ? r / b : 0, c, s
+    }'
+    rm -f "$BUILD_DIR"/client_*.log
+done
@@ -84,7 +84,7 @@ compile_lesson() {
     extra_flags=
 
     case "$lesson_path" in
-        *30_multithreaded_file_analyzer.c)
+        *26_simple_socket_server.c|*27_build_your_own_grep.c|*30_multithreaded_file_analyzer.c)
             extra_flags="-pthread"
             ;;
         *32_linking_external_libraries.c)
@@ -163,6 +163,74 @@ run_analyzer_check() {
         exit 1
     fi
 
+    stream_file=$BUILD_DIR/analyzer_stream.txt
+    awk 'BEGIN {
+        for (i = 0; i < 300000; i++) printf "word%d%s", i, (i % 7 == 0) ? "\n" : " ";
+    }' > "$stream_file"
+
+    set -- $(wc "$stream_file")
+    stream_output=$(cat "$stream_file" | "$analyzer_bin" -)
+    expect_contains "$stream_output" "Total Characters: $3" "Analyzer streaming character count is incorrect."
+    expect_contains "$stream_output" "Total Words:      $2" "Analyzer streaming word count is incorrect."
+    expect_contains "$stream_output" "Total Lines:      $1" "Analyzer streaming line count is incorrect."
+
+    top_file=$BUILD_DIR/analyzer_top.txt
+    printf 'beta alpha\ngamma alpha beta alpha\n' > "$top_file"
+    top_output=$("$analyzer_bin" --top 2 "$top_file")
+    expect_contains "$top_output" "1. alpha" "Analyzer --top did not rank the most frequent word first."
+    expect_contains "$top_output" "2. beta" "Analyzer --top did not rank the second most frequent word second."
+    expect_not_contains "$top_output" "gamma" "Analyzer --top reported more words than requested."
+
+    utf8_file=$BUILD_DIR/analyzer_utf8.txt
+    printf 'h\303\251llo w\303\266rld\na\302\240b \343\200\200c \377x\n' > "$utf8_file"
+    utf8_output=$("$analyzer_bin" --utf8 "$utf8_file")
+    expect_contains "$utf8_output" "Total Characters: 22" "Analyzer --utf8 character count is incorrect."
+    expect_contains "$utf8_output" "Total Words:      6" "Analyzer --utf8 did not split words on Unicode whitespace."
+    expect_contains "$utf8_output" "Invalid UTF-8:    1 bytes" "Analyzer --utf8 did not report the invalid byte."
+
+    cache_file=$BUILD_DIR/analyzer.cache
+    growing_file=$BUILD_DIR/analyzer_growing.txt
+    printf 'first line of the log\nsecond li' > "$growing_file"
+    "$analyzer_bin" --cache "$cache_file" "$growing_file" >/dev/null
+    printf 'ne continues\nthird line\n' >> "$growing_file"
+    set -- $(wc "$growing_file")
+    cache_output=$("$analyzer_bin" --cache "$cache_file" "$growing_file")
+    expect_contains "$cache_output" "Cache hit" "Analyzer --cache rescanned an appended file from the start."
+    expect_contains "$cache_output" "Total Words:      $2" "Analyzer --cache word count after append is incorrect."
+    expect_contains "$cache_output" "Total Characters: $3" "Analyzer --cache character count after append is incorrect."
+
+    trace_file=$BUILD_DIR/analyzer_trace.json
+    stats_output=$("$analyzer_bin" --stats --trace "$trace_file" "$sample_file" 2>&1 >/dev/null)
+    expect_contains "$stats_output" '"join_skew_seconds"' "Analyzer --stats did not report join skew."
+    expect_contains "$stats_output" '"role": "worker"' "Analyzer --stats did not report per-thread timings."
+    expect_contains "$(cat "$trace_file")" '"traceEvents"' "Analyzer --trace did not write a trace-event file."
+
+    placed_output=$("$analyzer_bin" --pin --mmap "$stream_file")
+    set -- $(wc "$stream_file")
+    expect_contains "$placed_output" "Pinning thread 0 to CPU" "Analyzer --pin did not report its CPU plan."
+    expect_contains "$placed_output" "Total Words:      $2" "Analyzer --mmap word count is incorrect."
+    expect_contains "$placed_output" "Total Characters: $3" "Analyzer --mmap character count is incorrect."
+
+    scalar_output=$("$analyzer_bin" --kernel scalar "$stream_file")
+    expect_contains "$scalar_output" "Total Words:      $2" "Analyzer --kernel scalar word count is incorrect."
+    expect_contains "$scalar_output" "Total Lines:      $1" "Analyzer --kernel scalar line count is incorrect."
+
+    lines_file=$BUILD_DIR/analyzer_lines.txt
+    awk 'BEGIN {
+        printf "short\n";
+        for (i = 0; i < 100000; i++) printf "x";
+        printf "\nlast line without newline";
+    }' > "$lines_file"
+    histogram_output=$("$analyzer_bin" --histogram "$lines_file")
+    expect_contains "$histogram_output" "Lines measured:   3" "Analyzer --histogram did not measure every line."
+    expect_contains "$histogram_output" "Longest line:     100000 bytes" "Analyzer --histogram did not stitch a line across chunks."
+    expect_contains "$histogram_output" "0x78 x       100000" "Analyzer --histogram byte counts are incorrect."
+    histogram_output=$(cat "$lines_file" | "$analyzer_bin" --histogram -)
+    expect_contains "$histogram_output" "Longest line:     100000 bytes" "Analyzer --histogram streaming line lengths are incorrect."
+
+    progress_output=$("$analyzer_bin" --progress "$stream_file" 2>&1 >/dev/null)
+    expect_contains "$progress_output" "Progress: 100.0%" "Analyzer --progress did not report completion."
+
     : > "$empty_file"
     empty_output=$("$analyzer_bin" "$empty_file")
     expect_contains "$empty_output" "File is empty. Nothing to analyze." "Analyzer did not report empty-file handling."
@@ -171,6 +239,152 @@ run_analyzer_check() {
     expect_contains "$empty_output" "Total Lines:      0" "Analyzer empty-file line count is incorrect."
 }
 
+run_grep_check() {
+    grep_bin=$BUILD_DIR/27_build_your_own_grep
+    grep_sample=$BUILD_DIR/grep_sample.txt
+
+    printf 'alpha beta\nabababab abab\nno match here\nthe quick brown fox jumps over the lazy dog\n' > "$grep_sample"
+
+    grep_output=$("$grep_bin" x "$grep_sample")
+    expect_contains "$grep_output" "brown fox" "grep did not find a single-byte pattern."
+    expect_not_contains "$grep_output" "alpha" "grep printed a line without the single-byte pattern."
+
+    grep_output=$("$grep_bin" "bab a" "$grep_sample")
+    expect_contains "$grep_output" "abababab abab" "grep did not find a short pattern."
+
+    grep_output=$("$grep_bin" "over the lazy dog" "$grep_sample")
+    expect_contains "$grep_output" "quick brown" "grep did not find a long pattern."
+    expect_not_contains "$grep_output" "no match" "grep printed a line without the long pattern."
+
+    grep_output=$("$grep_bin" "abababab abac" "$grep_sample")
+    expect_not_contains "$grep_output" "abababab abab" "grep matched a near miss of a periodic pattern."
+
+    # More than one 1 MiB read block, so lines are carried across block boundaries.
+    awk 'BEGIN { for (i = 1; i <= 40000; i++) printf "line %d %s filler filler filler\n", i, (i % 997 == 0) ? "needle" : "hay" }' > "$grep_sample"
+    grep_count=$("$grep_bin" needle "$grep_sample" | grep -c "needle filler")
+    if [ "$grep_count" -ne 40 ]; then
+        echo "grep found $grep_count of 40 matching lines in a multi-block file." >&2
+        exit 1
+    fi
+
+    # A 3 MiB line with the match across the first 1 MiB block boundary.
+    awk 'BEGIN {
+        for (i = 0; i < 1048570; i++) printf "a";
+        printf "long needle";
+        for (i = 0; i < 2097152; i++) printf "b";
+        printf "\nshort line\n";
+    }' > "$grep_sample"
+    grep_output=$("$grep_bin" "long needle" "$grep_sample" | wc -c)
+    if [ "$grep_output" -lt 3145733 ]; then
+        echo "grep did not print the whole long line around a match that crosses a block boundary." >&2
+        exit 1
+    fi
+
+    # Over 32 MiB, so with more than one CPU the file is split between threads.
+    awk 'BEGIN { for (i = 1; i <= 800000; i++) printf "line %d %s filler filler filler filler\n", i, (i % 997 == 0) ? "needle" : "hay" }' > "$grep_sample"
+    grep_output=$("$grep_bin" needle "$grep_sample" | sed -n 's/^line \([0-9]*\) needle.*/\1/p')
+    grep_count=$(printf '%s\n' "$grep_output" | wc -l)
+    if [ "$grep_count" -ne 802 ] || ! printf '%s\n' "$grep_output" | sort -n -c; then
+        echo "grep did not print the 802 matching lines of a big file in order." >&2
+        exit 1
+    fi
+    grep_count=$("$grep_bin" -c needle "$grep_sample" | tail -n 1)
+    if [ "$grep_count" != 802 ]; then
+        echo "grep -c counted $grep_count of 802 matching lines in a big file." >&2
+        exit 1
+    fi
+
+    grep_tree=$BUILD_DIR/grep_tree
+    mkdir -p "$grep_tree/b_dir/nested" "$grep_tree/empty"
+    printf 'needle in a\n' > "$grep_tree/a.txt"
+    printf 'hay\nneedle in nested\n' > "$grep_tree/b_dir/nested/c.txt"
+    printf 'needle in z\n' > "$grep_tree/z.txt"
+    printf 'needle\000binary\n' > "$grep_tree/b_dir/program.bin"
+    grep_output=$("$grep_bin" needle "$grep_tree" "$grep_sample")
+    expect_contains "$grep_output" "$grep_tree/b_dir/nested/c.txt:needle in nested" "grep did not search a nested directory."
+    expect_not_contains "$grep_output" "binary" "grep did not skip a binary file."
+    expect_not_contains "$grep_output" "hay" "grep printed a non-matching line from a directory."
+    grep_order=$(printf '%s\n' "$grep_output" | sed -n 's/.*needle in \([a-z]*\)$/\1/p' | tr '\n' ' ')
+    if [ "$grep_order" != "a nested z " ]; then
+        echo "grep printed directory results out of order: $grep_order" >&2
+        exit 1
+    fi
+    expect_contains "$grep_output" "$grep_sample:" "grep did not search a file given after a directory."
+    grep_output=$("$grep_bin" -c needle "$grep_tree")
+    expect_contains "$grep_output" "$grep_tree/b_dir/nested/c.txt:1" "grep -c did not count the matches of each file."
+    grep_output=$("$grep_bin" -l needle "$grep_tree")
+    expect_contains "$grep_output" "$grep_tree/z.txt" "grep -l did not list a matching file."
+    expect_not_contains "$grep_output" "needle in" "grep -l printed lines instead of file names."
+    grep_output=$("$grep_bin" -m 2 "needle filler" "$grep_sample")
+    expect_contains "$grep_output" "line 1994 needle" "grep -m 2 stopped too early."
+    expect_not_contains "$grep_output" "line 2991 needle" "grep -m 2 did not stop after two lines."
+
+    grep_patterns=$BUILD_DIR/grep_patterns.txt
+    printf 'alpha\nwords\nhe\nthe quick\n\nzzz\n' > "$grep_patterns"
+    printf 'the quick brown fox\nno such words\nlast line, xyz\n' > "$grep_sample"
+    grep_output=$("$grep_bin" -f "$grep_patterns" "$grep_sample")
+    expect_contains "$grep_output" "Searching for 5 patterns" "grep -f did not skip the empty pattern line."
+    expect_contains "$grep_output" "[he] the quick brown fox" "grep -f did not report the first pattern to match."
+    expect_contains "$grep_output" "[words] no such words" "grep -f did not find a pattern at the end of a line."
+    expect_not_contains "$grep_output" "xyz" "grep -f printed a line without any pattern."
+
+    grep_output=$("$grep_bin" -E 'qu(a|i)ck [a-z]+ fox$' "$grep_sample")
+    expect_contains "$grep_output" "the quick brown fox" "grep -E did not match an alternation with an anchor."
+    expect_not_contains "$grep_output" "words" "grep -E printed a line without a match."
+    grep_output=$("$grep_bin" -E '^no \w+ w?ords|x[y-z]{2}' "$grep_sample")
+    expect_contains "$grep_output" "no such words" "grep -E did not match a class with a quantifier."
+    expect_contains "$grep_output" "last line, xyz" "grep -E did not match a counted repetition."
+    expect_not_contains "$grep_output" "quick" "grep -E matched ^ in the middle of a line."
+    grep_output=$("$grep_bin" -E 'a(b' "$grep_sample" 2>&1 || true)
+    expect_contains "$grep_output" "Error in regular expression" "grep -E accepted an unbalanced parenthesis."
+
+    printf 'The Quick Brown Fox\nNO SUCH WORDS\nlast line, XYZ\n' > "$grep_sample"
+    grep_output=$("$grep_bin" -i "quick brown" "$grep_sample")
+    expect_contains "$grep_output" "The Quick Brown Fox" "grep -i did not ignore case."
+    expect_not_contains "$grep_output" "WORDS" "grep -i printed a line without a match."
+    grep_output=$("$grep_bin" -i x "$grep_sample")
+    expect_contains "$grep_output" "Fox" "grep -i did not ignore case in a single-letter pattern."
+    expect_not_contains "$grep_output" "WORDS" "grep -i matched the wrong letter."
+    grep_output=$("$grep_bin" -i -f "$grep_patterns" "$grep_sample")
+    expect_contains "$grep_output" "[words] NO SUCH WORDS" "grep -i -f did not ignore case."
+    grep_output=$("$grep_bin" -i -E '^no [^a-z]+ words' "$grep_sample")
+    expect_not_contains "$grep_output" "WORDS" "grep -i -E matched a letter with a negated range."
+    grep_output=$("$grep_bin" -i -E 'x[y-z]{2}$' "$grep_sample")
+    expect_contains "$grep_output" "last line, XYZ" "grep -i -E did not ignore case."
+
+    grep_output=$("$grep_bin" --fuzzy=1 "Quack Brown" "$grep_sample")
+    expect_contains "$grep_output" "The Quick Brown Fox" "grep --fuzzy=1 missed a match with one error."
+    grep_output=$("$grep_bin" --fuzzy=1 "Quack Brawn" "$grep_sample")
+    expect_not_contains "$grep_output" "Fox" "grep --fuzzy=1 matched with two errors."
+    grep_output=$("$grep_bin" -i --fuzzy=2 "quack brawn" "$grep_sample")
+    expect_contains "$grep_output" "The Quick Brown Fox" "grep -i --fuzzy=2 missed a match with two errors."
+    # Over 64 bytes, so the bit vectors take more than one word.
+    grep_fuzzy_pattern="connection refused by the remote server while sending the first request"
+    printf 'log: conection refused by the remote sever while sendng the first requests\n' > "$grep_sample"
+    grep_output=$("$grep_bin" --fuzzy=3 "$grep_fuzzy_pattern" "$grep_sample")
+    expect_contains "$grep_output" "log: conection refused" "grep --fuzzy missed a match of a long pattern."
+    grep_output=$("$grep_bin" --fuzzy=2 "$grep_fuzzy_pattern" "$grep_sample")
+    expect_not_contains "$grep_output" "log: conection refused" "grep --fuzzy matched a long pattern with too many errors."
+
+    grep_index=$BUILD_DIR/grep_index
+    mkdir -p "$grep_index/docs/sub"
+    printf 'alpha needle\n' > "$grep_index/docs/a.txt"
+    printf 'beta\n' > "$grep_index/docs/sub/b.txt"
+    grep_output=$(cd "$grep_index" && "$grep_bin" --index build docs)
+    expect_contains "$grep_output" "Indexed 2 files" "grep --index build did not index every file."
+    grep_output=$(cd "$grep_index" && "$grep_bin" --indexed needle)
+    expect_contains "$grep_output" "(1 of 2 files can match)" "grep --indexed did not narrow down the files."
+    expect_contains "$grep_output" "docs/a.txt:alpha needle" "grep --indexed did not find a match."
+    printf 'gamma NEEDLE\n' > "$grep_index/docs/sub/c.txt"
+    grep_output=$(cd "$grep_index" && "$grep_bin" -i --indexed needle 2>&1)
+    expect_contains "$grep_output" "docs/sub/c.txt:gamma NEEDLE" "grep --indexed did not search a file created after the index."
+    expect_contains "$grep_output" "1 new since the index was built" "grep --indexed did not report a file missing from the index."
+    grep_output=$(cd "$grep_index" && "$grep_bin" --index build docs)
+    expect_contains "$grep_output" "1 read, 2 unchanged" "grep --index build did not update the index incrementally."
+    grep_output=$(cd "$grep_index" && "$grep_bin" -i --indexed needle)
+    expect_contains "$grep_output" "docs/sub/c.txt:gamma NEEDLE" "grep --indexed missed a file added to the index."
+}
+
 run_socket_check() {
     server_bin=$BUILD_DIR/26_simple_socket_server
     client_bin=$BUILD_DIR/26_simple_socket_client
@@ -180,7 +394,7 @@ run_socket_check() {
     for attempt in 1 2 3 4 5; do
         port=$((35000 + ($$ + attempt) % 20000))
         : > "$server_log"
-        "$server_bin" "$port" > "$server_log" 2>&1 &
+        "$server_bin" --threads 3 "$port" > "$server_log" 2>&1 &
         SOCKET_SERVER_PID=$!
 
         for _ in 1 2 3 4 5 6 7 8 9 10; do
@@ -193,11 +407,41 @@ run_socket_check() {
 
         if kill -0 "$SOCKET_SERVER_PID" >/dev/null 2>&1; then
             client_output=$("$client_bin" 127.0.0.1 "$port" "Smoke test message" 2>&1)
+
+            # The server keeps running: many clients at once must all get replies.
+            client_pids=
+            for client in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+                "$client_bin" 127.0.0.1 "$port" "Client $client" > "$BUILD_DIR/socket_client_$client.log" 2>&1 &
+                client_pids="$client_pids $!"
+            done
+            for client_pid in $client_pids; do
+                wait "$client_pid" || true
+            done
+            many_output=$(cat "$BUILD_DIR"/socket_client_*.log)
+            rm -f "$BUILD_DIR"/socket_client_*.log
+
+            # A short open-loop load test: 20 connections, 2000 requests in one second.
+            load_status=0
+            load_output=$("$client_bin" --load --connections 20 --duration 1 --rate 2000 127.0.0.1 "$port" "load" 2>&1) || load_status=$?
+
+            kill -TERM "$SOCKET_SERVER_PID" >/dev/null 2>&1 || true
             wait "$SOCKET_SERVER_PID"
             SOCKET_SERVER_PID=
+            server_output=$(cat "$server_log")
 
             expect_contains "$client_output" "Server reply: Message received. Thank you!" "Socket client/server exchange did not complete successfully."
-            expect_contains "$(cat "$server_log")" "Connection accepted from" "Socket server did not accept the smoke-test client."
+            expect_contains "$server_output" "Connection accepted from" "Socket server did not accept the smoke-test client."
+            expect_contains "$server_output" "Client message from 127.0.0.1:" "Socket server did not print the client's message."
+            expect_contains "$server_output" "Served 41 connections and 2021 messages" "Socket server did not answer every client and load-test request."
+            expect_contains "$server_output" "Worker 2 accepted" "Socket server did not start three SO_REUSEPORT workers."
+            if [ "$(printf '%s\n' "$many_output" | grep -c 'Server reply: Message received. Thank you!')" != 20 ]; then
+                fail_with_output "Not every concurrent socket client got its reply." "$many_output"
+            fi
+            if [ "$load_status" != 0 ]; then
+                fail_with_output "Socket load test lost requests." "$load_output"
+            fi
+            expect_contains "$load_output" "Sent 2000 requests, received 2000 replies" "Socket load test did not send and receive every request."
+            expect_contains "$load_output" "p99.9" "Socket load test did not report its latency percentiles."
             return 0
         fi
 
@@ -389,6 +633,7 @@ test -x "$LESSON31_DIR/31_project_main"
 make -C "$LESSON31_DIR" clean >/dev/null
 
 run_analyzer_check
+run_grep_check
 run_socket_check
 run_student_record_checks
 run_tiny_shell_check